@@ -0,0 +1,133 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "acpi.h"
+#include "../memmap/memmap.h"
+#include "../memlayout.h"
+#include "../paging/paging.h"
+#include "../vm/vm.h"
+#include "../tty/tty.h"
+
+#define BIOS_ROM_START 0xE0000
+#define BIOS_ROM_END 0x100000
+#define EBDA_SEGMENT_PTR 0x40E // real-mode segment of the EBDA
+
+static struct acpi_header *root; // RSDT or XSDT, 0 without ACPI
+static int root_is_xsdt;
+
+static uint8_t checksum(void *p, uint64_t len) {
+    uint8_t sum = 0;
+    for (uint64_t i = 0; i < len; i++)
+        sum += ((uint8_t *) p)[i];
+    return sum;
+}
+
+static int valid_rsdp(struct acpi_rsdp *rsdp) {
+    for (int i = 0; i < 8; i++) {
+        if (rsdp->signature[i] != "RSD PTR "[i])
+            return 0;
+    }
+    return checksum(rsdp, 20) == 0;
+}
+
+// Firmware puts the RSDP on a 16-byte boundary in the first KiB of
+// the EBDA or in the BIOS ROM area
+static struct acpi_rsdp *scan_rsdp(uint64_t start, uint64_t end) {
+    for (uint64_t pa = start; pa + sizeof(struct acpi_rsdp) <= end; pa += 16) {
+        struct acpi_rsdp *rsdp = PHYS_TO_VIRT(pa);
+        if (valid_rsdp(rsdp))
+            return rsdp;
+    }
+    return 0;
+}
+
+// Tables in the first GiB are reached through the boot mapping, which
+// covers firmware ranges too; others are mapped on demand
+static void *acpi_map(uint64_t pa, uint64_t len) {
+    if (pa + len <= INIT_PHYSTOP)
+        return PHYS_TO_VIRT(pa);
+    return ioremap(pa, len, PTE_WB);
+}
+
+static void acpi_unmap(void *va, uint64_t pa, uint64_t len) {
+    if (pa + len > INIT_PHYSTOP)
+        iounmap(va);
+}
+
+// Map the header alone to learn the length, then the whole table
+static struct acpi_header *map_table(uint64_t pa) {
+    struct acpi_header *header = acpi_map(pa, sizeof(struct acpi_header));
+    if (header == 0)
+        return 0;
+    uint32_t length = header->length;
+    acpi_unmap(header, pa, sizeof(struct acpi_header));
+    if (length < sizeof(struct acpi_header))
+        return 0;
+
+    header = acpi_map(pa, length);
+    if (header != 0 && checksum(header, length) != 0) {
+        acpi_unmap(header, pa, length);
+        return 0;
+    }
+    return header;
+}
+
+void acpi_init(void) {
+    struct acpi_rsdp *rsdp = 0;
+
+    if (boot_rsdp.size != 0 && valid_rsdp((struct acpi_rsdp *) boot_rsdp.data))
+        rsdp = (struct acpi_rsdp *) boot_rsdp.data;
+    if (rsdp == 0) {
+        uint64_t ebda = (uint64_t) *(uint16_t *) PHYS_TO_VIRT(EBDA_SEGMENT_PTR) << 4;
+        if (ebda != 0)
+            rsdp = scan_rsdp(ebda, ebda + 1024);
+    }
+    if (rsdp == 0)
+        rsdp = scan_rsdp(BIOS_ROM_START, BIOS_ROM_END);
+    if (rsdp == 0) {
+        printf("acpi: no RSDP\n");
+        return;
+    }
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_addr != 0) {
+        root = map_table(rsdp->xsdt_addr);
+        root_is_xsdt = 1;
+    }
+    if (root == 0) {
+        root = map_table(rsdp->rsdt_addr);
+        root_is_xsdt = 0;
+    }
+    if (root == 0)
+        printf("acpi: bad root table\n");
+}
+
+// The first table with the given 4-character signature, checksum
+// verified, or 0. Give it back with acpi_put_table.
+void *acpi_find_table(char *signature) {
+    if (root == 0)
+        return 0;
+
+    uint32_t entry_size = root_is_xsdt ? 8 : 4;
+    uint32_t n = (root->length - sizeof(struct acpi_header)) / entry_size;
+    char *entries = (char *) (root + 1);
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t pa = root_is_xsdt ? *(uint64_t *) (entries + i * 8) : *(uint32_t *) (entries + i * 4);
+        struct acpi_header *header = acpi_map(pa, sizeof(struct acpi_header));
+        if (header == 0)
+            continue;
+        int match = *(uint32_t *) header->signature == *(uint32_t *) signature;
+        acpi_unmap(header, pa, sizeof(struct acpi_header));
+        if (match && (header = map_table(pa)) != 0)
+            return header;
+    }
+    return 0;
+}
+
+// Tables below INIT_PHYSTOP come from the direct map, the rest from ioremap
+void acpi_put_table(void *table) {
+    if ((uint64_t) table >= KVM_BASE && (uint64_t) table < KVM_END)
+        iounmap(table);
+}
@@ -0,0 +1,69 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_ACPI_H
+#define UNTITLED_OS_ACPI_H
+
+#include <inttypes.h>
+
+// ACPI tables, just enough to find the MADT.
+// https://uefi.org/specs/ACPI/6.5/05_ACPI_Software_Programming_Model.html
+
+struct acpi_rsdp {
+    char signature[8];           // "RSD PTR "
+    uint8_t checksum;            // over the first 20 bytes
+    char oem_id[6];
+    uint8_t revision;            // 0 for ACPI 1.0, 2 and up have the fields below
+    uint32_t rsdt_addr;
+    uint32_t length;
+    uint64_t xsdt_addr;
+    uint8_t ext_checksum;        // over the whole structure
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+struct acpi_header {
+    char signature[4];
+    uint32_t length;             // of the table, header included
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+// Multiple APIC Description Table, signature "APIC"
+struct acpi_madt {
+    struct acpi_header header;
+    uint32_t lapic_addr;
+    uint32_t flags;
+    uint8_t entries[0];          // variable length, see struct madt_entry
+} __attribute__((packed));
+
+#define MADT_LAPIC 0
+
+struct madt_entry {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+
+#define MADT_LAPIC_ENABLED 0x1
+#define MADT_LAPIC_ONLINE_CAPABLE 0x2
+
+struct madt_lapic {
+    struct madt_entry entry;
+    uint8_t acpi_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed));
+
+void acpi_init(void);
+
+void *acpi_find_table(char *signature);
+
+void acpi_put_table(void *table);
+
+#endif //UNTITLED_OS_ACPI_H
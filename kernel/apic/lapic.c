@@ -0,0 +1,97 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "lapic.h"
+#include "../sched/proc.h"
+#include "../paging/paging.h"
+#include "../vm/vm.h"
+#include "../lib/include/x86_64.h"
+#include "../lib/include/panic.h"
+#include "../pit/pit.h"
+
+// Local APIC in xAPIC mode. Legacy devices still come through the
+// 8259 PIC to the boot CPU; the APIC is used for interrupts between
+// processors and for the scheduler tick on the others.
+
+static volatile uint32_t *lapic; // register page, mapped uncached
+static uint32_t timer_count;      // timer counts per LAPIC_TIMER_PERIOD_US
+uint8_t lapic_ids[NCPU];
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t val) {
+    lapic[reg / 4] = val;
+    (void) lapic[LAPIC_ID / 4]; // wait for the write to land
+}
+
+// Enable this CPU's local APIC. The first call maps the register page,
+// which is at the same physical address on every CPU.
+void lapic_init(void) {
+    if (lapic == 0) {
+        uint64_t base = rdmsr(MSR_IA32_APIC_BASE) & PTE_ADDR_MASK;
+        lapic = ioremap(base, PGSIZE, PTE_UC);
+        if (lapic == 0)
+            panic("lapic_init");
+    }
+
+    // Keep the PIC wired through LINT0 as the BIOS left it (virtual wire)
+    if (cpuid() == 0) {
+        lapic_write(LAPIC_LINT0, LAPIC_LVT_EXTINT);
+        lapic_write(LAPIC_LINT1, LAPIC_LVT_NMI);
+    }
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS);
+    lapic_ids[cpuid()] = lapic_id();
+}
+
+uint8_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void send_icr(uint8_t apic_id, uint32_t icr) {
+    lapic_write(LAPIC_ICR_HI, (uint32_t) apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, icr);
+    while (lapic_read(LAPIC_ICR_LO) & LAPIC_ICR_PENDING)
+        ;
+}
+
+// Send a fixed interrupt to another CPU
+void lapic_send_ipi(int cpu, uint8_t vector) {
+    send_icr(lapic_ids[cpu], vector);
+}
+
+// Wake a sleeping processor into real mode at addr, which must be a
+// page below 1 MiB: INIT, then two start-up IPIs (Intel SDM 8.4.4)
+void lapic_start_ap(uint8_t apic_id, uint64_t addr) {
+    send_icr(apic_id, LAPIC_ICR_INIT);
+    pit_delay(10000);
+    for (int i = 0; i < 2; i++) {
+        send_icr(apic_id, LAPIC_ICR_STARTUP | (addr >> 12));
+        pit_delay(200);
+    }
+}
+
+// The timer runs at the bus clock, which no register tells, so count
+// it against the PIT once. All CPUs share the bus clock.
+void lapic_timer_calibrate(void) {
+    lapic_write(LAPIC_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV16);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    pit_delay(LAPIC_TIMER_PERIOD_US);
+    timer_count = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+// Tick this CPU every LAPIC_TIMER_PERIOD_US
+void lapic_timer_init(void) {
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV16);
+    lapic_write(LAPIC_TIMER, LAPIC_TIMER_PERIODIC | IRQ_LAPIC_TIMER);
+    lapic_write(LAPIC_TIMER_INIT, timer_count);
+}
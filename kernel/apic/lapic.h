@@ -0,0 +1,60 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_LAPIC_H
+#define UNTITLED_OS_LAPIC_H
+
+#include <inttypes.h>
+
+#define MSR_IA32_APIC_BASE 0x1B
+
+// Register offsets in the xAPIC MMIO page
+#define LAPIC_ID 0x020
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ICR_LO 0x300
+#define LAPIC_ICR_HI 0x310
+#define LAPIC_TIMER 0x320
+#define LAPIC_LINT0 0x350
+#define LAPIC_LINT1 0x360
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CUR 0x390
+#define LAPIC_TIMER_DIV 0x3E0
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_ICR_PENDING (1 << 12) // delivery status: not yet accepted
+#define LAPIC_ICR_INIT 0x4500       // INIT, level assert
+#define LAPIC_ICR_STARTUP 0x4600    // start-up IPI, the vector is the page number
+#define LAPIC_LVT_EXTINT (7 << 8)
+#define LAPIC_LVT_NMI (4 << 8)
+#define LAPIC_LVT_MASKED (1 << 16)
+#define LAPIC_TIMER_PERIODIC (1 << 17)
+#define LAPIC_TIMER_DIV16 0x3
+
+#define LAPIC_TIMER_PERIOD_US 10000 // scheduler tick on CPUs without the PIT
+
+// Interrupt vectors owned by the local APIC
+#define IRQ_LAPIC_TIMER 0xEF
+#define IPI_TLB_SHOOTDOWN 0xF0
+#define IPI_RESCHEDULE 0xF1 // work was queued for an idle CPU
+#define LAPIC_SPURIOUS 0xFF
+
+extern uint8_t lapic_ids[]; // APIC ID of each CPU, by cpuid()
+
+void lapic_init(void);
+
+uint8_t lapic_id(void);
+
+void lapic_eoi(void);
+
+void lapic_send_ipi(int cpu, uint8_t vector);
+
+void lapic_start_ap(uint8_t apic_id, uint64_t addr);
+
+void lapic_timer_calibrate(void);
+
+void lapic_timer_init(void);
+
+#endif //UNTITLED_OS_LAPIC_H
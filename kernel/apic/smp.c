@@ -0,0 +1,123 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "smp.h"
+#include "lapic.h"
+#include "../acpi/acpi.h"
+#include "../sched/proc.h"
+#include "../sched/scheduler.h"
+#include "../gdt/gdt.h"
+#include "../idt/idt.h"
+#include "../paging/paging.h"
+#include "../paging/tlb.h"
+#include "../kalloc/kalloc.h"
+#include "../pit/pit.h"
+#include "../memlayout.h"
+#include "../lib/include/memcpy.h"
+#include "../tty/tty.h"
+#include "../lib/include/panic.h"
+
+#define AP_START_TIMEOUT_MS 100
+
+extern char trampoline_start[], trampoline_data[], trampoline_end[];
+
+int ncpu_possible = 1;
+static volatile int ap_started;
+
+// First C code on an application processor, on its boot stack and
+// the trampoline's page table. The boot CPU waits for ap_started
+// before it starts the next one, so the AP's index is ncpu.
+static void ap_main(void) {
+    percpu_init(ncpu);
+    // The trampoline's GDT is not mapped in the kernel table
+    gdt_init();
+    idt_load();
+    wcr3(VIRT_TO_PHYS(kernel_pagetable));
+    pat_init();
+    pcid_init();
+    tlb_init();
+    lapic_init();
+    lapic_timer_init();
+
+    // Shootdowns reach this CPU from now on; entries cached before are
+    // dropped here
+    __sync_fetch_and_add(&ncpu, 1);
+    tlb_flush_all();
+    ap_started = 1;
+
+    scheduler();
+}
+
+// Record the APIC IDs of the other usable CPUs after the boot CPU's
+static void parse_madt(struct acpi_madt *madt) {
+    char *p = (char *) madt->entries;
+    char *end = (char *) madt + madt->header.length;
+
+    for (; p < end; p += ((struct madt_entry *) p)->length) {
+        struct madt_lapic *e = (struct madt_lapic *) p;
+        if (e->entry.length == 0)
+            break;
+        if (e->entry.type != MADT_LAPIC || e->apic_id == lapic_ids[0])
+            continue;
+        if (!(e->flags & (MADT_LAPIC_ENABLED | MADT_LAPIC_ONLINE_CAPABLE)))
+            continue;
+        if (ncpu_possible == NCPU) {
+            printf("smp: more than %d CPUs, ignoring APIC %d\n", NCPU, e->apic_id);
+            continue;
+        }
+        lapic_ids[ncpu_possible++] = e->apic_id;
+    }
+}
+
+// The trampoline enters long mode with paging on, so it needs a table
+// below 4 GiB that also maps itself at its physical address. Slot 0
+// borrows the direct map's PDPT for that, the rest are the kernel's.
+static void trampoline_setup(void) {
+    pagetable_t pml4 = PHYS_TO_VIRT(TRAMPOLINE_PML4);
+
+    memcpy(PHYS_TO_VIRT(TRAMPOLINE_BASE), trampoline_start, trampoline_end - trampoline_start);
+    memcpy(pml4, kernel_pagetable, PGSIZE);
+    pml4[0] = kernel_pagetable[((uint64_t) PHYS_BASE >> 39) & 511];
+}
+
+// Start every CPU the MADT lists, one at a time
+void smp_init(void) {
+    struct acpi_madt *madt = acpi_find_table("APIC");
+    if (madt == 0) {
+        printf("smp: no MADT, running on one CPU\n");
+        return;
+    }
+    parse_madt(madt);
+    acpi_put_table(madt);
+    if (ncpu_possible == 1)
+        return;
+
+    lapic_timer_calibrate();
+    trampoline_setup();
+    struct trampoline_data *data = PHYS_TO_VIRT(TRAMPOLINE_BASE + (trampoline_data - trampoline_start));
+
+    for (int cpu = 1; cpu < ncpu_possible; cpu++) {
+        char *stack = kalloc_order(AP_STACK_ORDER);
+        if (stack == 0)
+            panic("smp_init");
+        data->cr3 = TRAMPOLINE_PML4;
+        data->stack = (uint64_t) stack + (PGSIZE << AP_STACK_ORDER);
+        data->entry = (uint64_t) ap_main;
+        ap_started = 0;
+        __sync_synchronize();
+
+        lapic_start_ap(lapic_ids[cpu], TRAMPOLINE_BASE);
+        for (int ms = 0; ms < AP_START_TIMEOUT_MS && !ap_started; ms++)
+            pit_delay(1000);
+
+        // CPU indices must stay dense, so stop at the first that fails
+        if (!ap_started) {
+            printf("smp: APIC %d did not start\n", lapic_ids[cpu]);
+            ncpu_possible = cpu;
+            break;
+        }
+    }
+    printf("smp: %d CPUs online\n", ncpu);
+}
@@ -0,0 +1,29 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_SMP_H
+#define UNTITLED_OS_SMP_H
+
+#include <inttypes.h>
+
+// Low pages the application processors start from, reserved with the
+// rest of the memory below the kernel image
+#define TRAMPOLINE_BASE 0x8000 // the start code, see trampoline.asm
+#define TRAMPOLINE_PML4 0x9000 // its page table
+
+#define AP_STACK_ORDER 2 // boot and idle stack of each AP, 16 KiB
+
+// Filled in by the boot CPU for each AP it starts
+struct trampoline_data {
+    uint64_t cr3;
+    uint64_t stack;
+    uint64_t entry;
+};
+
+extern int ncpu_possible; // CPUs with an entry in lapic_ids
+
+void smp_init(void);
+
+#endif //UNTITLED_OS_SMP_H
@@ -0,0 +1,70 @@
+; Start code of the application processors. smp_init copies it to
+; TRAMPOLINE_BASE, a page below 1 MiB where a start-up IPI can point,
+; and fills in trampoline_data. It runs at the copy, so every label is
+; used as an offset from trampoline_start.
+
+TRAMPOLINE_BASE equ 0x8000 ; see smp.h
+%define ABS(label) (TRAMPOLINE_BASE + (label) - trampoline_start)
+
+global trampoline_start
+global trampoline_data
+global trampoline_end
+
+section .rodata
+bits 16
+trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [ABS(tr_gdt.pointer)]
+
+    ; Straight from real to long mode: PAE, the page table, EFER.LME,
+    ; then protection and paging (and write protection) in one go
+    mov eax, cr4
+    or eax, 1 << 5
+    mov cr4, eax
+    mov eax, [ABS(trampoline_data.cr3)]
+    mov cr3, eax
+    mov ecx, 0xC0000080
+    rdmsr
+    or eax, 1 << 8
+    wrmsr
+    mov eax, cr0
+    or eax, (1 << 31) | (1 << 16) | 1
+    mov cr0, eax
+    jmp dword tr_gdt.code:ABS(long_mode)
+
+bits 64
+long_mode:
+    mov ax, tr_gdt.data
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov rsp, [ABS(trampoline_data.stack)]
+    ; the entry is in the higher half and never returns
+    mov rax, [ABS(trampoline_data.entry)]
+    call rax
+    hlt
+
+align 8
+tr_gdt:
+    dq 0
+.code: equ $ - tr_gdt
+    dq (1<<44) | (1<<47) | (1<<41) | (1<<43) | (1<<53)
+.data: equ $ - tr_gdt
+    dq (1<<44) | (1<<47) | (1<<41)
+.pointer:
+    dw .pointer - tr_gdt - 1
+    dd ABS(tr_gdt)
+
+; struct trampoline_data in smp.h
+align 8
+trampoline_data:
+.cr3:
+    dq 0 ; physical, below 4 GiB
+.stack:
+    dq 0
+.entry:
+    dq 0
+trampoline_end:
@@ -0,0 +1,154 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "ata.h"
+#include "../sync/spinlock.h"
+#include "../lib/include/x86_64.h"
+#include "../tty/tty.h"
+
+// PIO driver for the master drive of the primary ATA bus. Transfers
+// poll the status register with the device's interrupt masked, so
+// they can run with spinlocks held.
+
+static struct spinlock ata_lock;
+static uint64_t nsectors; // 0 if there is no usable drive
+static int lba48;
+
+// Reading the alternate status four times gives the drive the 400 ns
+// it needs after a drive select or a command
+static void ata_delay(void) {
+    for (int i = 0; i < 4; i++)
+        inb(ATA_CTRL);
+}
+
+// Wait for BSY to clear and, with drq, for the drive to be ready to
+// move data. Returns -1 on a drive error or if the drive does not
+// answer within ATA_TIMEOUT_POLLS, the caller holds ata_lock with
+// interrupts off and maybe the VM locks too.
+static int ata_wait(int drq) {
+    uint8_t status;
+    uint32_t polls = 0;
+
+    while ((status = inb(ATA_IO + ATA_STATUS)) & ATA_SR_BSY) {
+        if (++polls == ATA_TIMEOUT_POLLS)
+            return -1;
+    }
+    if (status & (ATA_SR_ERR | ATA_SR_DF))
+        return -1;
+    while (drq && !((status = inb(ATA_IO + ATA_STATUS)) & ATA_SR_DRQ)) {
+        if (status & (ATA_SR_ERR | ATA_SR_DF) || ++polls == ATA_TIMEOUT_POLLS)
+            return -1;
+    }
+    return 0;
+}
+
+// Probe the drive. Returns its size in sectors, 0 if there is none.
+uint64_t ata_init(void) {
+    uint16_t id[256];
+
+    init_spinlock(&ata_lock, "ata");
+    outb(ATA_CTRL, ATA_CTRL_NIEN);
+
+    outb(ATA_IO + ATA_DRIVE, 0xA0);
+    ata_delay();
+    outb(ATA_IO + ATA_SECCOUNT, 0);
+    outb(ATA_IO + ATA_LBA0, 0);
+    outb(ATA_IO + ATA_LBA1, 0);
+    outb(ATA_IO + ATA_LBA2, 0);
+    outb(ATA_IO + ATA_COMMAND, ATA_CMD_IDENTIFY);
+
+    // A floating bus reads 0xFF, an absent drive 0
+    uint8_t status = inb(ATA_IO + ATA_STATUS);
+    if (status == 0 || status == 0xFF)
+        return 0;
+    for (uint32_t polls = 0; inb(ATA_IO + ATA_STATUS) & ATA_SR_BSY; polls++) {
+        if (polls == ATA_TIMEOUT_POLLS) {
+            printf("ata0: drive does not answer\n");
+            return 0;
+        }
+    }
+    // ATAPI and SATA devices put a signature here instead
+    if (inb(ATA_IO + ATA_LBA1) != 0 || inb(ATA_IO + ATA_LBA2) != 0)
+        return 0;
+    if (ata_wait(1) < 0)
+        return 0;
+    for (int i = 0; i < 256; i++)
+        id[i] = inw(ATA_IO + ATA_DATA);
+
+    lba48 = (id[83] >> 10) & 1;
+    if (lba48)
+        nsectors = id[100] | ((uint64_t) id[101] << 16) | ((uint64_t) id[102] << 32) | ((uint64_t) id[103] << 48);
+    else
+        nsectors = id[60] | ((uint64_t) id[61] << 16);
+
+    printf("ata0: %d MiB%s\n", (int) (nsectors / (1024 * 1024 / ATA_SECTOR_SIZE)), lba48 ? ", LBA48" : "");
+    return nsectors;
+}
+
+static void ata_command(uint64_t lba, uint32_t count, int write) {
+    if (lba48) {
+        outb(ATA_IO + ATA_DRIVE, 0x40);
+        ata_delay();
+        outb(ATA_IO + ATA_SECCOUNT, count >> 8);
+        outb(ATA_IO + ATA_LBA0, lba >> 24);
+        outb(ATA_IO + ATA_LBA1, lba >> 32);
+        outb(ATA_IO + ATA_LBA2, lba >> 40);
+        outb(ATA_IO + ATA_SECCOUNT, count);
+        outb(ATA_IO + ATA_LBA0, lba);
+        outb(ATA_IO + ATA_LBA1, lba >> 8);
+        outb(ATA_IO + ATA_LBA2, lba >> 16);
+        outb(ATA_IO + ATA_COMMAND, write ? ATA_CMD_WRITE_EXT : ATA_CMD_READ_EXT);
+    } else {
+        outb(ATA_IO + ATA_DRIVE, 0xE0 | ((lba >> 24) & 0xF));
+        ata_delay();
+        outb(ATA_IO + ATA_SECCOUNT, count);
+        outb(ATA_IO + ATA_LBA0, lba);
+        outb(ATA_IO + ATA_LBA1, lba >> 8);
+        outb(ATA_IO + ATA_LBA2, lba >> 16);
+        outb(ATA_IO + ATA_COMMAND, write ? ATA_CMD_WRITE : ATA_CMD_READ);
+    }
+}
+
+// Move count sectors (at most 256) starting at lba. Returns 0 or -1.
+// Writes may still sit in the drive's cache, which swap does not mind.
+static int ata_rw(uint64_t lba, uint32_t count, void *buf, int write) {
+    uint16_t *p = buf;
+
+    if (count == 0 || count > 256 || lba + count > nsectors || (!lba48 && lba + count > (1UL << 28)))
+        return -1;
+
+    acquire_spinlock(&ata_lock);
+    int r = ata_wait(0);
+    if (r == 0)
+        ata_command(lba, count, write); // a count of 256 goes out as 0, which means 256
+    for (uint32_t s = 0; r == 0 && s < count; s++) {
+        if ((r = ata_wait(1)) < 0)
+            break;
+        for (int i = 0; i < ATA_SECTOR_SIZE / 2; i++, p++) {
+            if (write)
+                outw(ATA_IO + ATA_DATA, *p);
+            else
+                *p = inw(ATA_IO + ATA_DATA);
+        }
+        ata_delay();
+    }
+    // The drive is BSY until it took the last sector, and reports its
+    // write errors then
+    if (r == 0 && write)
+        r = ata_wait(0);
+    if (r < 0)
+        printf("ata0: %s error at sector %d, error %x\n", write ? "write" : "read", (int) lba,
+               (int) inb(ATA_IO + ATA_ERROR));
+    release_spinlock(&ata_lock);
+    return r;
+}
+
+int ata_read(uint64_t lba, uint32_t count, void *buf) {
+    return ata_rw(lba, count, buf, 0);
+}
+
+int ata_write(uint64_t lba, uint32_t count, void *buf) {
+    return ata_rw(lba, count, buf, 1);
+}
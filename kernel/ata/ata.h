@@ -0,0 +1,52 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_ATA_H
+#define UNTITLED_OS_ATA_H
+
+#include <inttypes.h>
+
+#define ATA_SECTOR_SIZE 512
+
+// Primary bus, the CD-ROM QEMU boots from sits on the secondary one
+#define ATA_IO 0x1F0
+#define ATA_CTRL 0x3F6
+
+// Registers, offsets from ATA_IO
+#define ATA_DATA 0
+#define ATA_ERROR 1
+#define ATA_SECCOUNT 2
+#define ATA_LBA0 3
+#define ATA_LBA1 4
+#define ATA_LBA2 5
+#define ATA_DRIVE 6
+#define ATA_STATUS 7
+#define ATA_COMMAND 7
+
+#define ATA_SR_BSY 0x80
+#define ATA_SR_DRDY 0x40
+#define ATA_SR_DF 0x20
+#define ATA_SR_DRQ 0x08
+#define ATA_SR_ERR 0x01
+
+#define ATA_CMD_READ 0x20
+#define ATA_CMD_READ_EXT 0x24
+#define ATA_CMD_WRITE 0x30
+#define ATA_CMD_WRITE_EXT 0x34
+#define ATA_CMD_IDENTIFY 0xEC
+
+#define ATA_CTRL_NIEN 0x02 // no interrupts, the driver polls
+
+// Status reads before a drive is given up on, each takes about a
+// microsecond on the ISA-speed status port
+#define ATA_TIMEOUT_POLLS 2000000
+
+uint64_t ata_init(void);
+
+int ata_read(uint64_t lba, uint32_t count, void *buf);
+
+int ata_write(uint64_t lba, uint32_t count, void *buf);
+
+#endif //UNTITLED_OS_ATA_H
@@ -0,0 +1,409 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "bench.h"
+#include "../paging/paging.h"
+#include "../paging/tlb.h"
+#include "../vm/vm.h"
+#include "../kalloc/kalloc.h"
+#include "../memlayout.h"
+#include "../lib/include/x86_64.h"
+#include "../lib/include/panic.h"
+#include "../tty/tty.h"
+#include "../sync/spinlock.h"
+#include "../vm/swap.h"
+#include "../vm/zswap.h"
+#include "../kalloc/kmalloc.h"
+#include "../sched/proc.h"
+#include "../sched/runqueue.h"
+#include "../sched/scheduler.h"
+#include "../pit/pit.h"
+
+#define MAP_BENCH_VA 0x8000000000UL       // scratch address in an unused table
+#define MAP_BENCH_LEN (16 * 1024 * 1024)  // 4096 pages
+
+#define SWITCH_BENCH_ROUNDS 10000
+#define SWITCH_BENCH_ORDER 5               // 32 pages touched after each switch
+
+#define COLOR_BENCH_ROUNDS 1000
+#define COLOR_BENCH_MAX 128                // pages in the working set at most
+
+#define ZSWAP_BENCH_PAGES 256
+
+#define RQ_BENCH_PICKS 10000
+#define RQ_BENCH_SLICE 20000              // cycles each pick runs in the share test
+
+#define SMP_BENCH_WORKERS (2 * (NCPU - 1))
+#define SMP_BENCH_WARMUP_US 200000          // for the balancer to spread the workers
+#define SMP_BENCH_WINDOW_US 200000
+
+// Map the same range into a private table page by page through walk()
+// and in one map_range call. The table is never loaded, so no TLB cost.
+static void bench_map_range(void) {
+    uint64_t npages = MAP_BENCH_LEN / PGSIZE;
+    pagetable_t pt = kalloc_flags(KALLOC_ZERO);
+    if (pt == 0)
+        panic("bench_map_range");
+
+    uint64_t t0 = rdtsc();
+    for (uint64_t off = 0; off < MAP_BENCH_LEN; off += PGSIZE) {
+        page_entry_raw *pte = walk(pt, MAP_BENCH_VA + off, 1);
+        if (pte == 0)
+            panic("bench_map_range: walk");
+        init_entry(pte, off);
+    }
+    uint64_t t1 = rdtsc();
+    struct mmu_gather tlb;
+    tlb_gather_init(&tlb, pt, 0);
+    unmap_range(&tlb, MAP_BENCH_VA, MAP_BENCH_LEN, 0);
+    tlb_gather_finish(&tlb);
+
+    uint64_t t2 = rdtsc();
+    if (map_range(pt, MAP_BENCH_VA, 0, MAP_BENCH_LEN, PTE_W) < 0)
+        panic("bench_map_range: map_range");
+    uint64_t t3 = rdtsc();
+    tlb_gather_init(&tlb, pt, 0);
+    unmap_range(&tlb, MAP_BENCH_VA, MAP_BENCH_LEN, 0);
+    tlb_gather_finish(&tlb);
+    uint64_t t4 = rdtsc();
+
+    free_pagetable(pt);
+
+    printf("map %d pages: walk %d cycles/page, map_range %d cycles/page, unmap_range %d cycles/page\n",
+           (int) npages, (int) ((t1 - t0) / npages), (int) ((t3 - t2) / npages), (int) ((t4 - t3) / npages));
+}
+
+static uint64_t switch_rounds(pagetable_t a, pagetable_t b, bool flush) {
+    volatile char *buf = (volatile char *) MAP_BENCH_VA;
+
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i < SWITCH_BENCH_ROUNDS; i++) {
+        load_pagetable(i & 1 ? b : a, i & 1 ? 2 : 1, flush);
+        for (int j = 0; j < (1 << SWITCH_BENCH_ORDER); j++)
+            (void) buf[j * PGSIZE];
+    }
+    return (rdtsc() - t0) / SWITCH_BENCH_ROUNDS;
+}
+
+// Ping-pong between two address spaces that each touch their own 4 KiB
+// mappings after every switch: once flushing the TLB on each CR3 load,
+// once keeping the PCID-tagged entries.
+static void bench_pcid_switch(void) {
+    uint64_t len = (uint64_t) PGSIZE << SWITCH_BENCH_ORDER;
+    void *buf = kalloc_order_flags(SWITCH_BENCH_ORDER, KALLOC_ZERO);
+    pagetable_t a = new_pagetable();
+    pagetable_t b = new_pagetable();
+    if (buf == 0 || a == 0 || b == 0)
+        panic("bench_pcid_switch");
+    if (map_range(a, MAP_BENCH_VA, VIRT_TO_PHYS(buf), len, PTE_W) < 0 ||
+        map_range(b, MAP_BENCH_VA, VIRT_TO_PHYS(buf), len, PTE_W) < 0)
+        panic("bench_pcid_switch: map_range");
+
+    pushcli();
+    uint64_t flush = switch_rounds(a, b, 1);
+    uint64_t keep = switch_rounds(a, b, 0);
+    load_pagetable(kernel_pagetable, 0, 1);
+    popcli();
+
+    // Neither table is loaded any more, nothing to flush
+    struct mmu_gather tlb;
+    tlb_gather_init(&tlb, a, 0);
+    unmap_range(&tlb, MAP_BENCH_VA, len, 0);
+    tlb_gather_finish(&tlb);
+    tlb_gather_init(&tlb, b, 0);
+    unmap_range(&tlb, MAP_BENCH_VA, len, 0);
+    tlb_gather_finish(&tlb);
+    destroy_pagetable(a);
+    destroy_pagetable(b);
+    kfree_order(buf, SWITCH_BENCH_ORDER);
+
+    if (!pcid_enabled)
+        printf("PCID not supported, both runs flush\n");
+    printf("address space switch: flush %d cycles, pcid %d cycles\n", (int) flush, (int) keep);
+}
+
+// Free a touched vmalloc buffer: the unmap is flushed once at the end
+// instead of once per page
+static void bench_unmap_flush(void) {
+    uint64_t npages = MAP_BENCH_LEN / PGSIZE;
+    char *buf = vmalloc(MAP_BENCH_LEN);
+    if (buf == 0)
+        panic("bench_unmap_flush");
+    for (uint64_t off = 0; off < MAP_BENCH_LEN; off += PGSIZE)
+        buf[off] = 1;
+
+    uint64_t t0 = rdtsc();
+    vfree(buf);
+    uint64_t t1 = rdtsc();
+
+    printf("vfree %d pages: %d cycles/page\n", (int) npages, (int) ((t1 - t0) / npages));
+}
+
+static uint64_t color_rounds(void **bufs, int n) {
+    uint64_t t0 = rdtsc();
+    for (int r = 0; r < COLOR_BENCH_ROUNDS; r++) {
+        for (int i = 0; i < n; i++) {
+            for (int off = 0; off < PGSIZE; off += CACHE_LINE_SIZE)
+                (void) ((volatile char *) bufs[i])[off];
+        }
+    }
+    return (rdtsc() - t0) / ((uint64_t) COLOR_BENCH_ROUNDS * n * (PGSIZE / CACHE_LINE_SIZE));
+}
+
+// Walk a working set of twice the cache's associativity in pages,
+// first all of one color, where the pages fight over the same sets,
+// then spread over the colors, where it fits.
+static void bench_cache_colors(void) {
+    static void *bufs[COLOR_BENCH_MAX];
+    uint32_t ncolors = kalloc_ncolors();
+    if (ncolors == 1) {
+        printf("cache coloring off, no color benchmark\n");
+        return;
+    }
+
+    int n = 2 * kalloc_cache_ways();
+    if (n > COLOR_BENCH_MAX)
+        n = COLOR_BENCH_MAX;
+
+    uint64_t cycles[2];
+    for (int spread = 0; spread < 2; spread++) {
+        for (int i = 0; i < n; i++) {
+            if ((bufs[i] = kalloc_color(spread ? i : 0, KALLOC_ZERO)) == 0)
+                panic("bench_cache_colors");
+        }
+        color_rounds(bufs, n); // warm up
+        cycles[spread] = color_rounds(bufs, n);
+        for (int i = 0; i < n; i++)
+            kfree(bufs[i]);
+    }
+
+    printf("%d pages, %d colors: one color %d cycles/line, spread %d cycles/line\n",
+           n, (int) ncolors, (int) cycles[0], (int) cycles[1]);
+}
+
+// Page i of the zswap mix: a quarter zeroed, half filled with
+// structured records, a quarter random
+static void zswap_fill(uint64_t *words, int i) {
+    uint64_t x = 0x9E3779B97F4A7C15UL * (i + 1);
+    for (int w = 0; w < PGSIZE / 8; w++) {
+        if (i % 4 == 0) {
+            words[w] = 0;
+        } else if (i % 4 == 3) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            words[w] = x;
+        } else {
+            words[w] = w % 4 == 0 ? (uint64_t) i << 32 | w : KERNBASE + w * 16;
+        }
+    }
+}
+
+// Store a mix of pages in zswap and load them back
+static void bench_zswap(void) {
+    static uint64_t slots[ZSWAP_BENCH_PAGES];
+    static char stored[ZSWAP_BENCH_PAGES];
+    uint64_t *page = kalloc();
+    uint64_t *check = kalloc();
+    if (page == 0 || check == 0)
+        panic("bench_zswap");
+
+    struct zswap_stats before, after;
+    zswap_get_stats(&before);
+    uint64_t store = 0, load = 0;
+    int n = 0;
+    for (int i = 0; i < ZSWAP_BENCH_PAGES; i++) {
+        if ((slots[i] = swap_alloc()) == 0)
+            panic("bench_zswap: no swap slots");
+        zswap_fill(page, i);
+        uint64_t t0 = rdtsc();
+        stored[i] = zswap_store(slots[i], page) == 0;
+        store += rdtsc() - t0;
+        n += stored[i];
+    }
+    zswap_get_stats(&after);
+
+    for (int i = 0; i < ZSWAP_BENCH_PAGES; i++) {
+        if (stored[i]) {
+            uint64_t t0 = rdtsc();
+            zswap_load(slots[i], check);
+            load += rdtsc() - t0;
+            zswap_fill(page, i);
+            for (int w = 0; w < PGSIZE / 8; w++) {
+                if (check[w] != page[w])
+                    panic("bench_zswap: page changed");
+            }
+        }
+        swap_free(slots[i]);
+    }
+    kfree(page);
+    kfree(check);
+
+    uint64_t pool = after.pool_bytes - before.pool_bytes;
+    printf("zswap: %d of %d pages stored in %d KiB, store %d cycles/page, load %d cycles/page\n",
+           n, ZSWAP_BENCH_PAGES, (int) (pool / 1024), (int) (store / ZSWAP_BENCH_PAGES),
+           (int) (n ? load / n : 0));
+}
+
+// Fake threads spread over fake processes, for the run queue only.
+// They are never run, only moved through the queue.
+static struct thread *rq_threads(struct proc *procs, int nprocs, int n) {
+    struct thread *threads = kcalloc(n, sizeof(struct thread));
+    if (threads == 0)
+        panic("bench_runqueue");
+
+    for (int i = 0; i < nprocs; i++)
+        sched_init_proc(&procs[i]);
+    for (int i = 0; i < n; i++) {
+        sched_init_thread(&threads[i]);
+        threads[i].proc = &procs[i % nprocs];
+    }
+    return threads;
+}
+
+static void rq_drain(struct thread *threads, int n) {
+    for (int i = 0; i < n; i++)
+        change_thread_state(&threads[i], EXIT);
+    rq_pick_next(0); // the queue forgets the last one picked
+    kfree(threads);
+}
+
+// Cycles per scheduling decision with n threads, half of them blocked
+static uint64_t rq_rounds(int n) {
+    int nprocs = n / 16 + 1;
+    struct proc *procs = kcalloc(nprocs, sizeof(struct proc));
+    if (procs == 0)
+        panic("bench_runqueue");
+    struct thread *threads = rq_threads(procs, nprocs, n);
+
+    for (int i = 0; i < n; i++) {
+        thread_set_nice(&threads[i], i % 4);
+        change_thread_state(&threads[i], i % 2 ? WAIT : RUNNABLE);
+    }
+
+    struct thread *cur = 0;
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i < RQ_BENCH_PICKS; i++)
+        cur = rq_pick_next(cur);
+    uint64_t cycles = (rdtsc() - t0) / RQ_BENCH_PICKS;
+
+    rq_drain(threads, n);
+    kfree(procs);
+    return cycles;
+}
+
+// CPU shares of three processes: one thread, eight threads, and one
+// thread with twice the weight. They should get 25%, 25% and 50%
+// whatever their thread counts.
+static void rq_shares(void) {
+    static struct proc procs[3];
+    uint64_t ran[3] = {0, 0, 0};
+    struct thread *threads = rq_threads(procs, 3, 10);
+
+    proc_set_weight(&procs[2], 2 * NICE_0_WEIGHT);
+    for (int i = 0; i < 10; i++) {
+        threads[i].proc = &procs[i == 0 ? 0 : i == 9 ? 2 : 1];
+        change_thread_state(&threads[i], RUNNABLE);
+    }
+
+    struct thread *cur = 0;
+    for (int i = 0; i < RQ_BENCH_PICKS; i++) {
+        cur = rq_pick_next(cur);
+        uint64_t t0 = rdtsc();
+        while (rdtsc() - t0 < RQ_BENCH_SLICE)
+            ;
+        ran[cur->proc - procs] += rdtsc() - t0;
+    }
+    rq_pick_next(cur); // charge the last slice
+
+    uint64_t total = ran[0] + ran[1] + ran[2];
+    printf("run queue shares: 1 thread %d%%, 8 threads %d%%, weight x2 %d%%\n",
+           (int) (ran[0] * 100 / total), (int) (ran[1] * 100 / total), (int) (ran[2] * 100 / total));
+    rq_drain(threads, 10);
+}
+
+// The pick should cost about the same however many threads there are
+static void bench_runqueue(void) {
+    static int sizes[] = {16, 256, 4096};
+    for (int i = 0; i < 3; i++)
+        printf("run queue: %d threads, %d cycles/pick\n", sizes[i], (int) rq_rounds(sizes[i]));
+    rq_shares();
+}
+
+// Work done by each stress worker, a cache line each so the counts
+// measure the scheduler and not false sharing
+static struct {
+    volatile uint64_t count;
+} __attribute__((aligned(CACHE_LINE_SIZE))) smp_work[SMP_BENCH_WORKERS];
+
+static volatile int smp_stop;
+
+static void smp_worker(int index, struct argument *args) {
+    while (!smp_stop)
+        smp_work[index].count++;
+}
+
+static uint64_t smp_total(int n) {
+    uint64_t total = 0;
+    for (int i = 0; i < n; i++)
+        total += smp_work[i].count;
+    return total;
+}
+
+// Always-runnable workers confined to CPUs 1..n for n = 1 .. ncpu-1,
+// the boot CPU only measures. With the run queues spreading them the
+// work done should grow about linearly with n.
+static void bench_smp_scaling(void) {
+    int nworkers = 2 * (ncpu - 1);
+    struct thread *workers[SMP_BENCH_WORKERS];
+    struct proc *proc = allocproc();
+    if (proc == 0)
+        panic("bench_smp_scaling");
+
+    smp_stop = 0;
+    for (int i = 0; i < nworkers; i++) {
+        workers[i] = create_thread((void (*)(void *)) smp_worker, i, 0);
+        add_thread(proc, workers[i]);
+        thread_set_affinity(workers[i], 1UL << 1);
+        change_thread_state(workers[i], RUNNABLE);
+    }
+
+    uint64_t base = 0;
+    for (int n = 1; n < ncpu; n++) {
+        for (int i = 0; i < nworkers; i++)
+            thread_set_affinity(workers[i], ((1UL << (n + 1)) - 1) & ~1UL);
+        pit_delay(SMP_BENCH_WARMUP_US);
+
+        uint64_t start = smp_total(nworkers);
+        pit_delay(SMP_BENCH_WINDOW_US);
+        uint64_t work = smp_total(nworkers) - start;
+        if (n == 1)
+            base = work ? work : 1;
+        printf("smp: %d workers on %d CPUs, %d units/ms, speedup x%d.%d\n", nworkers, n,
+               (int) (work * 1000 / SMP_BENCH_WINDOW_US), (int) (work / base), (int) (work * 10 / base % 10));
+    }
+
+    // The workers return and exit through thread_start
+    smp_stop = 1;
+    sched_print_stats();
+}
+
+void run_smp_benchmarks(void) {
+    if (ncpu == 1) {
+        printf("smp: one CPU, skipping the scaling benchmark\n");
+        return;
+    }
+    bench_smp_scaling();
+}
+
+void run_benchmarks(void) {
+    printf("Running benchmarks\n");
+    bench_map_range();
+    bench_pcid_switch();
+    bench_unmap_flush();
+    bench_cache_colors();
+    bench_zswap();
+    bench_runqueue();
+}
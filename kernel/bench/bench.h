@@ -0,0 +1,16 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_BENCH_H
+#define UNTITLED_OS_BENCH_H
+
+// Boot-time microbenchmarks, enabled with make BENCH=1.
+// Results are printed in TSC cycles.
+void run_benchmarks(void);
+
+// Needs the other CPUs online and the scheduler running
+void run_smp_benchmarks(void);
+
+#endif //UNTITLED_OS_BENCH_H
@@ -0,0 +1,48 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "gdt.h"
+#include "../sched/proc.h"
+#include "../lib/include/memset.h"
+
+struct gdtr {
+    uint16_t limit;
+    uint64_t base;
+} __attribute__((packed));
+
+static uint64_t gdt[NCPU][GDT_ENTRIES];
+static struct tss tss[NCPU];
+static char ist_stacks[NCPU][IST_STACK_SIZE] __attribute__((aligned(16)));
+static char pf_stacks[NCPU][IST_STACK_SIZE] __attribute__((aligned(16)));
+
+// Replace the boot GDT with one that has a TSS, so faults that find
+// the stack unusable (a kernel stack overflow into a guard page) can
+// still run on a known-good interrupt stack.
+void gdt_init(void) {
+    int cpu = cpuid();
+    uint64_t *g = gdt[cpu];
+    struct tss *t = &tss[cpu];
+    uint64_t base = (uint64_t) t;
+    uint64_t limit = sizeof(struct tss) - 1;
+
+    memset(t, 0, sizeof(struct tss));
+    t->ist[IST_DOUBLE_FAULT - 1] = (uint64_t) (ist_stacks[cpu] + IST_STACK_SIZE);
+    t->ist[IST_PAGE_FAULT - 1] = (uint64_t) (pf_stacks[cpu] + IST_STACK_SIZE);
+    t->iomap_base = sizeof(struct tss);
+
+    g[0] = 0;
+    g[1] = (1UL << 44) | (1UL << 47) | (1UL << 41) | (1UL << 43) | (1UL << 53);
+    g[2] = (1UL << 44) | (1UL << 47) | (1UL << 41);
+    // Available 64-bit TSS, present
+    g[3] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) | (0x9UL << 40) | (1UL << 47) |
+           (((limit >> 16) & 0xF) << 48) | (((base >> 24) & 0xFF) << 56);
+    g[4] = base >> 32;
+
+    struct gdtr gdtr;
+    gdtr.limit = sizeof(gdt[cpu]) - 1;
+    gdtr.base = (uint64_t) g;
+    asm volatile("lgdt %0" : : "m" (gdtr));
+    asm volatile("ltr %0" : : "r" ((uint16_t) GDT_TSS));
+}
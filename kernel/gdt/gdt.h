@@ -0,0 +1,35 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_GDT_H
+#define UNTITLED_OS_GDT_H
+
+#include <inttypes.h>
+#include "../memlayout.h"
+
+// Selectors, code and data match the boot GDT in boot.asm
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_TSS 0x18
+#define GDT_ENTRIES 5 // null, code, data and the two halves of the TSS
+
+// Interrupt stack table slots (1-based, 0 keeps the current stack)
+#define IST_DOUBLE_FAULT 1
+#define IST_PAGE_FAULT 2 // a stack growing into an unbacked page cannot take its own fault
+#define IST_STACK_SIZE (4 * PGSIZE)
+
+struct tss {
+    uint32_t reserved0;
+    uint64_t rsp[3];      // stacks for entering rings 0-2
+    uint64_t reserved1;
+    uint64_t ist[7];      // interrupt stack table
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+} __attribute__((packed));
+
+void gdt_init(void);
+
+#endif //UNTITLED_OS_GDT_H
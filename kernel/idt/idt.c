@@ -7,6 +7,8 @@
 #include "../lib/include/memset.h"
 #include "../pic/pic.h"
 #include "../pit/pit.h"
+#include "../gdt/gdt.h"
+#include "../apic/lapic.h"
 
 #define MAX_INTERRUPTS 256
 void make_interrupt(struct InterruptDescriptor64* idt, int array_index, uintptr_t handler){
@@ -18,12 +20,19 @@ void make_interrupt(struct InterruptDescriptor64* idt, int array_index, uintptr_
     idt[array_index].offset_3 = (uint32_t)((handler) >> 32);
 }
 
-void setup_idt(){
-    struct InterruptDescriptor64 idt[MAX_INTERRUPTS]; // Создаем массив для 256 дескрипторов (для всех возможных прерываний)
+// Must outlive setup_idt, the CPU keeps using it after lidt
+static struct InterruptDescriptor64 idt[MAX_INTERRUPTS]; // Создаем массив для 256 дескрипторов (для всех возможных прерываний)
+
+// Point this CPU at the IDT built by setup_idt
+void idt_load(void) {
     // Настройка регистра IDTR
     struct IDTR idtr;
     idtr.limit = sizeof(struct InterruptDescriptor64) * MAX_INTERRUPTS - 1;
     idtr.base = (uint64_t)&idt;
+    asm volatile ("lidt %0" : : "m"(idtr));
+}
+
+void setup_idt(){
     memset(&idt, 0, sizeof(struct InterruptDescriptor64) * MAX_INTERRUPTS);
     for (int i = 0; i < MAX_INTERRUPTS; ++i) {
         make_interrupt(idt, i, (uintptr_t)default_handler);
@@ -31,6 +40,9 @@ void setup_idt(){
     // Настроим дескриптор IDT для деления на ноль (INT 0x0)
     make_interrupt(idt, PIC_MASTER_OFFSET, (uintptr_t)timer_interrupt);
     make_interrupt(idt, PIC_MASTER_OFFSET+1, (uintptr_t)keyboard_handler);
+    make_interrupt(idt, IPI_TLB_SHOOTDOWN, (uintptr_t)tlb_shootdown_interrupt);
+    make_interrupt(idt, IRQ_LAPIC_TIMER, (uintptr_t)lapic_timer_interrupt);
+    make_interrupt(idt, IPI_RESCHEDULE, (uintptr_t)reschedule_interrupt);
     
     make_interrupt(idt, 0, (uintptr_t)interrupt_handler_0);
     make_interrupt(idt, 1, (uintptr_t)interrupt_handler_1);
@@ -65,8 +77,15 @@ void setup_idt(){
     make_interrupt(idt, 30, (uintptr_t)interrupt_handler_30);
     make_interrupt(idt, 31, (uintptr_t)interrupt_handler_31);
 
+    // A double fault usually means the stack is gone, run it on its own
+    idt[8].ist = IST_DOUBLE_FAULT;
+    // Thread stacks are backed on demand, so the fault that grows one
+    // cannot be pushed onto it. The handler keeps interrupts off and
+    // touches only backed memory, so the stack is never entered twice.
+    idt[14].ist = IST_PAGE_FAULT;
+
     // Загрузка IDTR
-    asm volatile ("lidt %0" : : "m"(idtr));
+    idt_load();
 
     pic_init();
     init_pit();
@@ -24,4 +24,5 @@ struct InterruptDescriptor64 {
     uint32_t zero;            // reserved
 };
 void setup_idt();
+void idt_load(void);
 #endif //UNTITLED_OS_IDT_H
@@ -8,6 +8,9 @@
 #include "../tty/tty.h"
 #include "../sched/scheduler.h"
 #include "../pit/pit.h"
+#include "../vm/vm.h"
+#include "../paging/tlb.h"
+#include "../apic/lapic.h"
 #define F1 0x3B
 
 struct interrupt_frame;
@@ -30,6 +33,11 @@ __attribute__((interrupt)) void keyboard_handler(struct interrupt_frame* frame)
     // printf("Flags: %b\n", get_flags());
 }
 
+__attribute__((interrupt)) void tlb_shootdown_interrupt(struct interrupt_frame* frame) {
+    tlb_shootdown_handler();
+    lapic_eoi();
+}
+
 __attribute__((interrupt)) void default_handler(struct interrupt_frame* frame) {
     print("unknown interrupt\n");
 }
@@ -38,11 +46,19 @@ __attribute__((interrupt)) void timer_interrupt(struct interrupt_frame* frame) {
 //     print("clock\n");
     send_values_to_sched();
     outb(PIC1_COMMAND, PIC_EOI);
-    struct thread *next_thread = get_next_thread();
-    struct thread *prev_thread = current_cpu.current_thread;
-    current_cpu.current_thread = next_thread;
-    sti();
-    switch_context(&(prev_thread->context), next_thread->context);
+    schedule();
+}
+
+// The tick of the CPUs the PIT does not reach
+__attribute__((interrupt)) void lapic_timer_interrupt(struct interrupt_frame* frame) {
+    lapic_eoi();
+    schedule();
+}
+
+// Another CPU queued a thread here while this one was idle
+__attribute__((interrupt)) void reschedule_interrupt(struct interrupt_frame* frame) {
+    lapic_eoi();
+    schedule();
 }
 
 char* error_messages[] = {
@@ -81,6 +97,11 @@ char* error_messages[] = {
 };
 
 void interrupt_handler(uint64_t error_code, uint64_t interrupt_number) {
+    if (interrupt_number == 14 && vm_fault(rcr2(), error_code) == 0)
+        return;
+    if (interrupt_number == 8 && vm_is_guard(rcr2()))
+        printf("Kernel stack overflow at %p\n", rcr2());
+
     printf("Interrupt number %d (%s), error_code: %b\n", interrupt_number, error_messages[interrupt_number], error_code);
     printf("CR2: %x\n", rcr2());
     while (1) {}
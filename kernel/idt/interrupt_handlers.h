@@ -10,6 +10,9 @@
 void keyboard_handler_wrapper();
 void keyboard_handler();
 void timer_interrupt();
+void tlb_shootdown_interrupt();
+void lapic_timer_interrupt();
+void reschedule_interrupt();
 void default_handler();
 void interrupt_handler(uint64_t, uint64_t);
 
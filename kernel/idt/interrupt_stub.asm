@@ -3,21 +3,20 @@ extern interrupt_handler
 %macro no_error_code_interrupt_handler 1
 global interrupt_handler_%1
 interrupt_handler_%1:
-    mov   rdi, qword 0                     ; push 0 as error code
-    mov   rsi, qword %1                    ; push the interrupt number
+    push  qword 0                       ; push 0 as error code
+    push  qword %1                      ; push the interrupt number
     jmp     common_interrupt_handler    ; jump to the common handler
 %endmacro
 
 %macro error_code_interrupt_handler 1
 global interrupt_handler_%1
 interrupt_handler_%1:
-    pop rdi
-    mov rsi, qword %1                    ; push the interrupt number
+    push  qword %1                      ; push the interrupt number
     jmp     common_interrupt_handler     ; jump to the common handler
 %endmacro
 
 common_interrupt_handler:               ; the common parts of the generic interrupt handler
-    ; save the registers
+    ; save the registers, the handler may return to the interrupted code
     push rax      ;save current rax
     push rbx      ;save current rbx
     push rcx      ;save current rcx
@@ -34,7 +33,10 @@ common_interrupt_handler:               ; the common parts of the generic interr
     push r14      ;save current r14
     push r15      ;save current r15
 
-    ; call the C function
+    ; call the C function with the error code and the interrupt number
+    ; pushed above the 15 saved registers; rsp stays 16-byte aligned
+    mov rdi, [rsp + 16*8]
+    mov rsi, [rsp + 15*8]
     call    interrupt_handler
 
     ; restore the registers
@@ -54,8 +56,11 @@ common_interrupt_handler:               ; the common parts of the generic interr
     pop rbx
     pop rax
 
+    ; drop the interrupt number and error code
+    add rsp, 16
+
     ; return to the code that got interrupted
-    iret
+    iretq
 
 no_error_code_interrupt_handler 0
 no_error_code_interrupt_handler 1
@@ -1,71 +1,593 @@
 #include "../kalloc/kalloc.h"
 #include "../sync/spinlock.h"
 #include "../memlayout.h"
+#include "../list/list.h"
+#include "../lib/include/panic.h"
 //#include "../lib/include/stdint.h"
 #include <inttypes.h>
 #include <stddef.h>
 #include "../tty/tty.h"
+#include "../memmap/memmap.h"
+#include "../lib/include/x86_64.h"
+#include "../vm/reclaim.h"
 
-struct run {
-    struct run *next;
-};
+// Binary buddy allocator.
+//
+// Free blocks of 2^order pages sit on free_area[order]; the list
+// links live inside the free block itself. A block of order n
+// starting at page number pfn has its buddy at pfn ^ (1 << n), so
+// freeing merges with the buddy for as long as the buddy is a
+// free block of the same order.
+//
+// Order-0 pages are served from per-CPU magazines in front of the
+// buddy lists. A magazine is only touched by its own CPU with
+// interrupts off, so the common path takes no lock; kmem.lock is
+// taken once per batch when a magazine is refilled or drained.
+//
+// Pages are not cleared on free. Each CPU also keeps a small pool of
+// pages zeroed ahead of time by kalloc_zero_idle(), which KALLOC_ZERO
+// requests take first. Building with KALLOC_DEBUG fills freed and
+// newly allocated memory with junk to catch dangling references.
+//
+// Callers that care where their page lands in the cache ask for a
+// color with kalloc_color. Pages whose addresses differ by a multiple
+// of the largest cache's way size compete for the same sets; a page's
+// color is its page number modulo the number of such pages per way.
+// Colored pages come from per-color lists, refilled by splitting one
+// buddy block that holds a page of every color. They are freed like
+// any other page.
+//
+// All accounting is kept in counters updated where blocks move, so
+// statistics are read in constant time. Order-0 usage is counted per
+// CPU to keep the magazine path free of shared writes.
+
+#define PCP_BATCH 32 // pages moved between a magazine and the buddy lists at once
+#define PCP_HIGH 128 // magazine size that triggers a drain
+#define ZERO_POOL_HIGH 64 // pre-zeroed pages kept per CPU
+#define MAX_COLORS 64 // bigger caches are colored coarser
+#define COLOR_HIGH 16 // pages kept on a color list, extras of a refill go back
+
+#define JUNK 5
+
+struct page *pages; // one entry per page below phys_top
 
 struct {
     struct spinlock lock;
-    struct run *freelist;
+    int ready;
+    struct list free_area[KALLOC_MAX_ORDER + 1];
+    uint64_t nr_free[KALLOC_MAX_ORDER + 1];  // free blocks per order
+    uint64_t nr_used[KALLOC_MAX_ORDER + 1];  // allocated blocks per order, order 0 is per CPU
+    uint64_t failures[KALLOC_MAX_ORDER + 1];
+    uint64_t npages;
+    uint64_t total_pages;
+    uint64_t free_pages;                     // pages on the buddy lists
+    uint64_t high_water;
 } kmem;
 
+struct pcp {
+    struct list pages;
+    uint32_t count;
+    struct list zeroed;
+    uint32_t nr_zeroed;
+    int64_t allocs; // order-0 pages handed out minus pages freed on this CPU
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct pcp pcp[NCPU];
+
+// Color lists, under kmem.lock
+static struct {
+    uint32_t ncolors;  // 1 when coloring is off
+    uint32_t order;    // a block of this order holds every color once
+    uint32_t ways;     // associativity of the colored cache
+    uint32_t next;     // round-robin cursor for KALLOC_ANY_COLOR
+    struct list free[MAX_COLORS];
+    uint32_t nr_free[MAX_COLORS];
+    uint64_t total;    // pages on all color lists
+    uint64_t misses;
+} colors;
+
+// Put a block on its free list, coalescing with free buddies.
+static void free_block(uint64_t pfn, uint32_t order) {
+    kmem.free_pages += 1UL << order;
+    while (order < KALLOC_MAX_ORDER) {
+        uint64_t buddy = pfn ^ (1UL << order);
+        if (buddy >= kmem.npages || !(pages[buddy].flags & PG_FREE) || pages[buddy].order != order)
+            break;
+        lst_remove(pfn2va(buddy));
+        kmem.nr_free[order]--;
+        pages[buddy].flags &= ~PG_FREE;
+        pfn &= ~(1UL << order);
+        order++;
+    }
+    pages[pfn].flags |= PG_FREE;
+    pages[pfn].order = order;
+    lst_push(&kmem.free_area[order], pfn2va(pfn));
+    kmem.nr_free[order]++;
+}
+
+// Take the smallest free block of at least the given order and
+// split it down, returning the upper halves to the free lists.
+static void *alloc_block(uint32_t order) {
+    uint32_t current = order;
+    while (current <= KALLOC_MAX_ORDER && lst_empty(&kmem.free_area[current]))
+        current++;
+    if (current > KALLOC_MAX_ORDER)
+        return 0;
+
+    void *block = lst_pop(&kmem.free_area[current]);
+    kmem.nr_free[current]--;
+    uint64_t pfn = va2pfn(block);
+    pages[pfn].flags &= ~PG_FREE;
+
+    while (current > order) {
+        current--;
+        uint64_t half = pfn + (1UL << current);
+        pages[half].flags |= PG_FREE;
+        pages[half].order = current;
+        lst_push(&kmem.free_area[current], pfn2va(half));
+        kmem.nr_free[current]++;
+    }
+    pages[pfn].order = order;
+
+    kmem.free_pages -= 1UL << order;
+    if (kmem.total_pages - kmem.free_pages > kmem.high_water)
+        kmem.high_water = kmem.total_pages - kmem.free_pages;
+    return block;
+}
+
+// Return the coldest pages of a magazine list to the buddy lists.
+// Called with interrupts off.
+static void pcp_drain(struct list *lst, uint32_t *nr, uint32_t count) {
+    acquire_spinlock(&kmem.lock);
+    while (count-- > 0 && *nr > 0) {
+        struct list *page = lst->prev;
+        lst_remove(page);
+        (*nr)--;
+        va2page(page)->flags &= ~PG_PCP;
+        free_block(va2pfn(page), 0);
+    }
+    release_spinlock(&kmem.lock);
+}
+
+static void *pcp_alloc(void) {
+    void *r = 0;
+
+    pushcli();
+    struct pcp *p = &pcp[cpuid()];
+    if (p->count == 0) {
+        acquire_spinlock(&kmem.lock);
+        while (p->count < PCP_BATCH) {
+            void *page = alloc_block(0);
+            if (page == 0)
+                break;
+            va2page(page)->flags |= PG_PCP;
+            lst_push(&p->pages, page);
+            p->count++;
+        }
+        release_spinlock(&kmem.lock);
+    }
+    if (p->count > 0) {
+        r = lst_pop(&p->pages);
+        p->count--;
+        p->allocs++;
+        va2page(r)->flags &= ~PG_PCP;
+    }
+    popcli();
+
+    return r;
+}
+
+static void *pcp_alloc_zeroed(void) {
+    void *r = 0;
+
+    pushcli();
+    struct pcp *p = &pcp[cpuid()];
+    if (p->nr_zeroed > 0) {
+        r = lst_pop(&p->zeroed);
+        p->nr_zeroed--;
+        p->allocs++;
+        va2page(r)->flags &= ~PG_PCP;
+    }
+    popcli();
+
+    if (r) {
+        // The list links were written into the page after it was cleared
+        ((struct list *) r)->next = 0;
+        ((struct list *) r)->prev = 0;
+        return r;
+    }
+    if ((r = pcp_alloc()) != 0)
+        memset(r, 0, PGSIZE);
+    else
+        __sync_fetch_and_add(&kmem.failures[0], 1);
+    return r;
+}
+
+static void pcp_free(void *va) {
+    pushcli();
+    struct pcp *p = &pcp[cpuid()];
+    va2page(va)->flags |= PG_PCP;
+    lst_push(&p->pages, va);
+    p->count++;
+    p->allocs--;
+    if (p->count >= PCP_HIGH)
+        pcp_drain(&p->pages, &p->count, PCP_BATCH);
+    popcli();
+}
+
+// Size the color lists from the largest data cache CPUID leaf 4
+// reports. Without the leaf (e.g. on AMD) coloring stays off.
+static void color_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    uint64_t way_size = 0;
+    uint32_t level = 0;
+
+    colors.ncolors = 1;
+    for (int i = 0; i < MAX_COLORS; i++)
+        lst_init(&colors.free[i]);
+
+    cpuid_count(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 4)
+        return;
+    for (uint32_t i = 0; ; i++) {
+        cpuid_count(4, i, &eax, &ebx, &ecx, &edx);
+        uint32_t type = eax & 0x1F;
+        if (type == 0)
+            break;
+        if (type == 2 || ((eax >> 5) & 0x7) < level)
+            continue; // instruction cache, or a smaller one
+        level = (eax >> 5) & 0x7;
+        uint64_t line = (ebx & 0xFFF) + 1;
+        uint64_t partitions = ((ebx >> 12) & 0x3FF) + 1;
+        colors.ways = ((ebx >> 22) & 0x3FF) + 1;
+        way_size = line * partitions * ((uint64_t) ecx + 1);
+    }
+
+    while (colors.ncolors < MAX_COLORS && ((uint64_t) colors.ncolors << 1) * PGSIZE <= way_size) {
+        colors.ncolors <<= 1;
+        colors.order++;
+    }
+}
+
+// Spread a block holding one page of each color over the color lists.
+// Called with kmem.lock held.
+static int color_refill(void) {
+    void *block = alloc_block(colors.order);
+    if (block == 0)
+        return -1;
+
+    uint64_t pfn = va2pfn(block);
+    for (uint64_t i = pfn; i < pfn + colors.ncolors; i++) {
+        uint32_t c = i & (colors.ncolors - 1);
+        if (colors.nr_free[c] >= COLOR_HIGH) {
+            free_block(i, 0);
+            continue;
+        }
+        pages[i].order = 0;
+        pages[i].flags |= PG_COLOR;
+        lst_push(&colors.free[c], pfn2va(i));
+        colors.nr_free[c]++;
+        colors.total++;
+    }
+    return 0;
+}
+
+// Give every page on the color lists back. Called with kmem.lock held.
+static void color_drain(void) {
+    for (uint32_t c = 0; c < colors.ncolors; c++) {
+        while (colors.nr_free[c] > 0) {
+            void *page = lst_pop(&colors.free[c]);
+            colors.nr_free[c]--;
+            va2page(page)->flags &= ~PG_COLOR;
+            free_block(va2pfn(page), 0);
+        }
+    }
+    colors.total = 0;
+}
+
+// Set up the allocator and give it every page the memory map
+// still lists as usable. Runs once kvminit has mapped all of RAM.
+void kinit(void) {
+    init_spinlock(&kmem.lock, "kmem");
+    for (int i = 0; i <= KALLOC_MAX_ORDER; i++)
+        lst_init(&kmem.free_area[i]);
+    for (int i = 0; i < NCPU; i++)
+        lst_init(&pcp[i].pages);
+    for (int i = 0; i < NCPU; i++)
+        lst_init(&pcp[i].zeroed);
+
+    kmem.npages = phys_top >> PGSHIFT;
+    pages = memmap_early_alloc(kmem.npages * sizeof(struct page));
+    if (pages == 0)
+        panic("kinit: no room for page metadata");
+    memset(pages, 0, kmem.npages * sizeof(struct page));
+
+    // Hand each region over in the largest naturally aligned blocks
+    acquire_spinlock(&kmem.lock);
+    for (int i = 0; i < nr_phys_regions; i++) {
+        struct phys_region *r = &phys_regions[i];
+        if (r->type != PHYS_USABLE)
+            continue;
+
+        uint64_t pfn = r->base >> PGSHIFT;
+        uint64_t end_pfn = (r->base + r->length) >> PGSHIFT;
+        while (pfn < end_pfn) {
+            uint32_t order = 0;
+            while (order < KALLOC_MAX_ORDER && (pfn & (1UL << order)) == 0 &&
+                   pfn + (1UL << (order + 1)) <= end_pfn)
+                order++;
+            kmem.total_pages += 1UL << order;
+            free_block(pfn, order);
+            pfn += 1UL << order;
+        }
+    }
+    release_spinlock(&kmem.lock);
 
-void kinit(uint64_t start, uint64_t stop) {
-    //  init_spinlock(&kmem.lock, "kmem");
-    char *p;
-    p = (char *) PGROUNDUP(start);
-    for (; p + PGSIZE < stop; p += PGSIZE)
-        kfree(p);
+    color_init();
+    kmem.ready = 1;
 }
 
-void kfree(void *pa) {
-    struct run *r;
+int kalloc_ready(void) {
+    return kmem.ready;
+}
 
-    if (((uint64_t) pa % PGSIZE) != 0 || (char *) pa < end || (uint64_t) pa >= PHYSTOP) {
-        printf("Panic while trying to free memory\nPA: %p END: %p PHYSTOP: %p", pa, end, PHYSTOP);
+void kfree_order(void *va, uint32_t order) {
+    uint64_t pa = VIRT_TO_PHYS(va);
+    if (order > KALLOC_MAX_ORDER || (pa % ((uint64_t) PGSIZE << order)) != 0 ||
+        pa < KERN_TO_PHYS(KEND) || pa >= phys_top) {
+        printf("Panic while trying to free memory\nVA: %p END: %p PHYSTOP: %p", va, KERN_TO_PHYS(KEND), phys_top);
+        panic("kfree");
+    }
+    if (pages[va2pfn(va)].flags & (PG_FREE | PG_PCP | PG_COLOR)) {
+        printf("Double free of VA: %p\n", va);
         panic("kfree");
     }
 
+    if (pages[va2pfn(va)].flags & PG_LRU)
+        lru_del(va);
+
+#ifdef KALLOC_DEBUG
     // Fill with junk to catch dangling refs.
-    char *testpa = (pa + PGSIZE - 1);
-    memset(pa, 0, PGSIZE);
+    memset(va, JUNK, (uint64_t) PGSIZE << order);
+#endif
+
+    if (order == 0) {
+        pcp_free(va);
+        return;
+    }
 
-    r = (struct run *) pa;
+    acquire_spinlock(&kmem.lock);
+    kmem.nr_used[order]--;
+    free_block(va2pfn(va), order);
+    release_spinlock(&kmem.lock);
+}
+
+void *kalloc_order_flags(uint32_t order, int flags) {
+    void *r;
+
+    if (order > KALLOC_MAX_ORDER)
+        return 0;
+
+    if (order == 0 && (flags & KALLOC_ZERO)) {
+        if ((r = pcp_alloc_zeroed()) != 0)
+            va2page(r)->refs = 1;
+        return r;
+    }
+
+    if (order == 0) {
+        r = pcp_alloc();
+    } else {
+        acquire_spinlock(&kmem.lock);
+        if ((r = alloc_block(order)) != 0)
+            kmem.nr_used[order]++;
+        release_spinlock(&kmem.lock);
+
+        // Pages parked in this CPU's magazine may complete a block
+        if (r == 0) {
+            pushcli();
+            struct pcp *p = &pcp[cpuid()];
+            pcp_drain(&p->pages, &p->count, p->count);
+            pcp_drain(&p->zeroed, &p->nr_zeroed, p->nr_zeroed);
+            acquire_spinlock(&kmem.lock);
+            color_drain();
+            if ((r = alloc_block(order)) != 0)
+                kmem.nr_used[order]++;
+            release_spinlock(&kmem.lock);
+            popcli();
+        }
+    }
+
+    if (r == 0) {
+        __sync_fetch_and_add(&kmem.failures[order], 1);
+        return 0;
+    }
+    va2page(r)->refs = 1;
+
+    if (flags & KALLOC_ZERO)
+        memset(r, 0, (uint64_t) PGSIZE << order);
+#ifdef KALLOC_DEBUG
+    else if (!(flags & KALLOC_NOINIT))
+        memset((char *) r, JUNK, (uint64_t) PGSIZE << order); // fill with junk
+#endif
+    return r;
+}
+
+// Drop a reference taken by page_get or the allocation itself,
+// freeing the block with the last one
+void page_put(void *va) {
+    struct page *page = va2page(va);
+    if (__sync_sub_and_fetch(&page->refs, 1) == 0)
+        kfree_order(va, page->order);
+}
 
-//    acquire_spinlock(&kmem.lock);
-    r->next = kmem.freelist;
-    kmem.freelist = r;
-//    release_spinlock(&kmem.lock);
+// Turn an allocated block into 2^order separately allocated pages,
+// each taking over the block's references, so its pages can be
+// freed one at a time
+void kalloc_split(void *va, uint32_t order) {
+    struct page *head = va2page(va);
+    if (head->order != order || (head->flags & (PG_FREE | PG_PCP | PG_COLOR | PG_SLAB)))
+        panic("kalloc_split");
+    if (order == 0)
+        return;
+
+    for (uint64_t i = 0; i < (1UL << order); i++) {
+        head[i].order = 0;
+        head[i].refs = head->refs;
+    }
+
+    acquire_spinlock(&kmem.lock);
+    kmem.nr_used[order]--;
+    release_spinlock(&kmem.lock);
+
+    // Counted as order-0 pages from now on, freed through the magazines
+    pushcli();
+    pcp[cpuid()].allocs += 1L << order;
+    popcli();
+}
+
+// Take a reference to a block mapped whole, or to each of its pages
+// once kalloc_split has broken it up
+void page_get_block(void *va, uint32_t order) {
+    if (va2page(va)->order == order) {
+        page_get(va);
+        return;
+    }
+    for (uint64_t i = 0; i < (1UL << order); i++)
+        page_get((char *) va + i * PGSIZE);
+}
+
+void *kalloc_order(uint32_t order) {
+    return kalloc_order_flags(order, 0);
+}
+
+void *kalloc_flags(int flags) {
+    return kalloc_order_flags(0, flags);
 }
 
 void *kalloc() {
-    struct run *r;
+    return kalloc_order_flags(0, 0);
+}
 
-//    acquire_spinlock(&kmem.lock);
-    r = kmem.freelist;
-    if (r)
-        kmem.freelist = r->next;
-//    release_spinlock(&kmem.lock);
+uint32_t kalloc_ncolors(void) {
+    return colors.ncolors;
+}
 
-    if (r)
-        memset((char *) r, 5, PGSIZE); // fill with junk
-    return (void *) r;
+uint32_t kalloc_cache_ways(void) {
+    return colors.ways;
 }
 
-uint64_t count_pages() {
-    struct run *r = kmem.freelist;
-    uint64_t res = 0;
+uint32_t page_color(void *va) {
+    return va2pfn(va) & (colors.ncolors - 1);
+}
+
+uint32_t kalloc_next_color(void) {
+    return __sync_fetch_and_add(&colors.next, 1) & (colors.ncolors - 1);
+}
+
+// One page of the given color, taken modulo the number of colors, or
+// of the next color in turn for KALLOC_ANY_COLOR. Falls back to any
+// page when coloring is off or no block is left to split.
+void *kalloc_color(int color, int flags) {
+    void *r = 0;
+
+    if (colors.ncolors == 1)
+        return kalloc_flags(flags);
+    uint32_t c = color == KALLOC_ANY_COLOR ? kalloc_next_color() : (uint32_t) color & (colors.ncolors - 1);
+
+    acquire_spinlock(&kmem.lock);
+    if (colors.nr_free[c] > 0 || color_refill() == 0) {
+        r = lst_pop(&colors.free[c]);
+        colors.nr_free[c]--;
+        colors.total--;
+        va2page(r)->flags &= ~PG_COLOR;
+        pcp[cpuid()].allocs++;
+    }
+    release_spinlock(&kmem.lock);
 
-    while (r != 0) {
-        res++;
-        r = r->next;
+    if (r == 0) {
+        __sync_fetch_and_add(&colors.misses, 1);
+        return kalloc_flags(flags);
     }
+    va2page(r)->refs = 1;
+
+    if (flags & KALLOC_ZERO)
+        memset(r, 0, PGSIZE);
+#ifdef KALLOC_DEBUG
+    else if (!(flags & KALLOC_NOINIT))
+        memset(r, JUNK, PGSIZE);
+#endif
+    return r;
+}
+
+// Top up this CPU's pool of zeroed pages by one page.
+// Returns 0 once the pool is full or memory runs out.
+int kalloc_zero_idle(void) {
+    pushcli();
+    int full = pcp[cpuid()].nr_zeroed >= ZERO_POOL_HIGH;
+    popcli();
+    if (full)
+        return 0;
+
+    void *page = pcp_alloc();
+    if (page == 0)
+        return 0;
+    memset(page, 0, PGSIZE);
+
+    pushcli();
+    struct pcp *p = &pcp[cpuid()];
+    va2page(page)->flags |= PG_PCP;
+    lst_push(&p->zeroed, page);
+    p->nr_zeroed++;
+    p->allocs--; // parked in the pool, not handed out
+    popcli();
+
+    return 1;
+}
+
+uint64_t count_pages() {
+    uint64_t res = kmem.free_pages + colors.total;
+
+    for (int i = 0; i < NCPU; i++)
+        res += pcp[i].count + pcp[i].nr_zeroed;
 
     return res;
-}
\ No newline at end of file
+}
+
+void kmem_get_stats(struct kmem_stats *stats) {
+    int64_t used0 = 0;
+
+    stats->cached_pages = 0;
+    for (int i = 0; i < NCPU; i++) {
+        stats->cached_pages += pcp[i].count + pcp[i].nr_zeroed;
+        used0 += pcp[i].allocs;
+    }
+    stats->cached_pages += colors.total;
+    stats->color_misses = colors.misses;
+
+    stats->total_pages = kmem.total_pages;
+    stats->free_pages = kmem.free_pages + stats->cached_pages;
+    stats->used_pages = stats->total_pages - stats->free_pages;
+    stats->high_water = kmem.high_water;
+    for (int order = 0; order <= KALLOC_MAX_ORDER; order++) {
+        stats->free_blocks[order] = kmem.nr_free[order];
+        stats->used_blocks[order] = kmem.nr_used[order];
+        stats->failures[order] = kmem.failures[order];
+    }
+    stats->used_blocks[0] = used0 > 0 ? used0 : 0;
+}
+
+void kmem_print_stats(void) {
+    struct kmem_stats stats;
+    kmem_get_stats(&stats);
+
+    printf("pages: total %d used %d free %d (cached %d) high water %d\n",
+           (int) stats.total_pages, (int) stats.used_pages, (int) stats.free_pages,
+           (int) stats.cached_pages, (int) stats.high_water);
+    printf("order  free  used  failed\n");
+    for (int order = 0; order <= KALLOC_MAX_ORDER; order++) {
+        printf("%d  %d  %d  %d\n", order, (int) stats.free_blocks[order],
+               (int) stats.used_blocks[order], (int) stats.failures[order]);
+    }
+    if (colors.ncolors > 1)
+        printf("colors: %d, misses %d\n", (int) colors.ncolors, (int) stats.color_misses);
+}
@@ -3,10 +3,92 @@
 
 //#include "../lib/include/stdint.h"
 #include <inttypes.h>
+#include "../memlayout.h"
+#include "../list/list.h"
 
-void kinit(uint64_t, uint64_t);
+#define KALLOC_MAX_ORDER 10 // largest block is 2^10 pages (4 MiB)
+
+// kalloc flags
+#define KALLOC_ZERO 0x1   // return zeroed memory
+#define KALLOC_NOINIT 0x2 // caller overwrites everything, skip debug junk fill
+
+#define PG_FREE 0x1 // page heads a block on a free list
+#define PG_SLAB 0x2 // page belongs to a slab
+#define PG_LARGE 0x4 // page heads a large kmalloc block
+#define PG_PCP 0x8 // page sits in a per-CPU magazine
+#define PG_COLOR 0x10 // page sits on a color list
+#define PG_LRU 0x20 // anonymous page on an LRU list, see vm/reclaim.c
+#define PG_ACTIVE 0x40 // on the active rather than the inactive list
+#define PG_ISOLATED 0x80 // PG_LRU page taken off its list by reclaim for now
+
+#define KALLOC_ANY_COLOR (-1) // kalloc_color: take the colors in turn
+
+// Per-page metadata, indexed by physical page number. Blocks are
+// handed out as direct map addresses, see PHYS_TO_VIRT
+struct page {
+    uint8_t flags;
+    uint8_t order; // order of the block this page heads (or of its slab)
+    uint16_t refs; // references to an allocated block, 1 when handed out
+    uint32_t owner; // pid of the process an anonymous page was faulted in for
+    uint64_t index; // and its address there
+    struct list lru;
+};
+
+extern struct page *pages;
+
+static inline uint64_t va2pfn(void *va) {
+    return VIRT_TO_PHYS(va) >> PGSHIFT;
+}
+
+static inline void *pfn2va(uint64_t pfn) {
+    return PHYS_TO_VIRT(pfn << PGSHIFT);
+}
+
+static inline struct page *va2page(void *va) {
+    return &pages[va2pfn(va)];
+}
+
+static inline void *page2va(struct page *page) {
+    return pfn2va(page - pages);
+}
+
+// Take another reference to an allocated block, e.g. for a page
+// mapped into several address spaces; page_put drops it
+static inline void page_get(void *va) {
+    __sync_fetch_and_add(&va2page(va)->refs, 1);
+}
+
+struct kmem_stats {
+    uint64_t total_pages;
+    uint64_t used_pages;
+    uint64_t free_pages;                        // buddy lists and per-CPU pools
+    uint64_t cached_pages;                      // of the free pages, those in per-CPU pools and color lists
+    uint64_t high_water;                        // most pages ever out of the buddy lists
+    uint64_t free_blocks[KALLOC_MAX_ORDER + 1]; // free blocks per order
+    uint64_t used_blocks[KALLOC_MAX_ORDER + 1]; // allocated blocks per order
+    uint64_t failures[KALLOC_MAX_ORDER + 1];    // failed allocations per order
+    uint64_t color_misses;                      // colored requests served with any page
+};
+
+void kinit(void);
+int kalloc_ready(void);
 void *kalloc(void);
-void kfree(void*);
+void kfree(void*); // frees a page block or a kmalloc object
+void *kalloc_flags(int flags);
+void *kalloc_order(uint32_t order);
+void *kalloc_order_flags(uint32_t order, int flags);
+void kfree_order(void *va, uint32_t order);
+void page_put(void *va);
+void kalloc_split(void *va, uint32_t order);
+void page_get_block(void *va, uint32_t order);
 uint64_t count_pages();
+int kalloc_zero_idle(void);
+void *kalloc_color(int color, int flags);
+uint32_t kalloc_next_color(void);
+uint32_t kalloc_ncolors(void);
+uint32_t kalloc_cache_ways(void);
+uint32_t page_color(void *va);
+void kmem_get_stats(struct kmem_stats *stats);
+void kmem_print_stats(void);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,151 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "kmalloc.h"
+#include "slab.h"
+#include "../memlayout.h"
+#include "../lib/include/memset.h"
+#include "../lib/include/memcpy.h"
+#include "../lib/include/panic.h"
+#include "../tty/tty.h"
+
+#define LARGE_CLASS KMALLOC_CLASSES
+
+static char *class_names[KMALLOC_CLASSES] = {
+    "kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1k", "kmalloc-2k"
+};
+
+static struct kmem_cache *kmalloc_caches[KMALLOC_CLASSES];
+static struct kmalloc_stats stats[KMALLOC_CLASSES + 1];
+
+// Smallest power of two that holds size, as a class index
+static int size_class(size_t size) {
+    int shift = KMALLOC_MIN_SHIFT;
+    while (((size_t) 1 << shift) < size)
+        shift++;
+    return shift - KMALLOC_MIN_SHIFT;
+}
+
+static uint32_t size_order(size_t size) {
+    uint32_t order = 0;
+    while (((size_t) PGSIZE << order) < size)
+        order++;
+    return order;
+}
+
+static void account(int class, size_t requested, size_t allocated) {
+    __sync_fetch_and_add(&stats[class].allocs, 1);
+    __sync_fetch_and_add(&stats[class].bytes_requested, requested);
+    __sync_fetch_and_add(&stats[class].bytes_allocated, allocated);
+}
+
+void kmalloc_init(void) {
+    for (int i = 0; i < KMALLOC_CLASSES; i++) {
+        size_t size = (size_t) 1 << (i + KMALLOC_MIN_SHIFT);
+        size_t align = size < CACHE_LINE_SIZE ? size : CACHE_LINE_SIZE;
+        kmalloc_caches[i] = kmem_cache_create(class_names[i], size, align, 0);
+        if (kmalloc_caches[i] == 0)
+            panic("kmalloc_init");
+    }
+}
+
+void *kmalloc(size_t size) {
+    void *ptr;
+
+    if (size == 0)
+        return 0;
+
+    if (size <= ((size_t) 1 << KMALLOC_MAX_SHIFT)) {
+        int class = size_class(size);
+        if ((ptr = kmem_cache_alloc(kmalloc_caches[class])) != 0)
+            account(class, size, (size_t) 1 << (class + KMALLOC_MIN_SHIFT));
+        return ptr;
+    }
+
+    uint32_t order = size_order(size);
+    if (order > KALLOC_MAX_ORDER)
+        return 0;
+    if ((ptr = kalloc_order(order)) != 0) {
+        va2page(ptr)->flags |= PG_LARGE;
+        account(LARGE_CLASS, size, (size_t) PGSIZE << order);
+    }
+    return ptr;
+}
+
+void *kcalloc(size_t n, size_t size) {
+    if (size != 0 && n > (size_t) -1 / size)
+        return 0;
+
+    void *ptr = kmalloc(n * size);
+    if (ptr)
+        memset(ptr, 0, n * size);
+    return ptr;
+}
+
+size_t ksize(void *ptr) {
+    struct page *page = va2page(ptr);
+
+    if (page->flags & PG_SLAB) {
+        struct slab *slab = (struct slab *) ((uint64_t) ptr & ~(((uint64_t) PGSIZE << page->order) - 1));
+        return slab->cache->object_size;
+    }
+    return (size_t) PGSIZE << page->order;
+}
+
+void *krealloc(void *ptr, size_t size) {
+    if (ptr == 0)
+        return kmalloc(size);
+    if (size == 0) {
+        kfree(ptr);
+        return 0;
+    }
+
+    size_t old_size = ksize(ptr);
+    if (size <= old_size)
+        return ptr;
+
+    void *new_ptr = kmalloc(size);
+    if (new_ptr == 0)
+        return 0;
+    memcpy(new_ptr, ptr, old_size);
+    kfree(ptr);
+    return new_ptr;
+}
+
+void kfree(void *ptr) {
+    if (ptr == 0)
+        return;
+
+    struct page *page = va2page(ptr);
+
+    if (page->flags & PG_SLAB) {
+        struct slab *slab = (struct slab *) ((uint64_t) ptr & ~(((uint64_t) PGSIZE << page->order) - 1));
+        int class = size_class(slab->cache->object_size);
+        if (class < KMALLOC_CLASSES && slab->cache == kmalloc_caches[class])
+            __sync_fetch_and_add(&stats[class].frees, 1);
+        kmem_cache_free(slab->cache, ptr);
+    } else {
+        if (page->flags & PG_LARGE) {
+            page->flags &= ~PG_LARGE;
+            __sync_fetch_and_add(&stats[LARGE_CLASS].frees, 1);
+        }
+        kfree_order(ptr, page->order);
+    }
+}
+
+void kmalloc_get_stats(struct kmalloc_stats out[KMALLOC_CLASSES + 1]) {
+    memcpy(out, stats, sizeof(stats));
+}
+
+void kmalloc_print_stats(void) {
+    printf("class        allocs   active   waste%%\n");
+    for (int i = 0; i <= KMALLOC_CLASSES; i++) {
+        struct kmalloc_stats *s = &stats[i];
+        int waste = s->bytes_allocated ? (s->bytes_allocated - s->bytes_requested) * 100 / s->bytes_allocated : 0;
+        printf("%s  %d  %d  %d\n", i < KMALLOC_CLASSES ? class_names[i] : "kmalloc-pages",
+               (int) s->allocs, (int) (s->allocs - s->frees), waste);
+    }
+}
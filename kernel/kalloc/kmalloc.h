@@ -0,0 +1,39 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_KMALLOC_H
+#define UNTITLED_OS_KMALLOC_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "kalloc.h"
+
+#define KMALLOC_MIN_SHIFT 3  // smallest size class is 8 bytes
+#define KMALLOC_MAX_SHIFT 11 // largest size class is 2 KiB, bigger requests take whole pages
+#define KMALLOC_CLASSES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+struct kmalloc_stats {
+    uint64_t allocs;          // allocations served by this class
+    uint64_t frees;
+    uint64_t bytes_requested; // sum of requested sizes
+    uint64_t bytes_allocated; // sum of sizes actually handed out
+};
+
+void kmalloc_init(void);
+
+void *kmalloc(size_t size);
+
+void *kcalloc(size_t n, size_t size);
+
+void *krealloc(void *ptr, size_t size);
+
+size_t ksize(void *ptr);
+
+// Index KMALLOC_CLASSES holds the page-sized allocations
+void kmalloc_get_stats(struct kmalloc_stats stats[KMALLOC_CLASSES + 1]);
+
+void kmalloc_print_stats(void);
+
+#endif //UNTITLED_OS_KMALLOC_H
@@ -0,0 +1,250 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "slab.h"
+#include "kalloc.h"
+#include "../memlayout.h"
+#include "../lib/include/panic.h"
+#include "../vm/reclaim.h"
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+#define SLAB_KEEP_EMPTY 1 // empty slabs kept per cache before giving pages back
+
+static struct kmem_cache cache_cache; // the cache of struct kmem_cache
+static struct list cache_chain;
+
+static inline void *get_freeptr(struct kmem_cache *cache, void *obj) {
+    return *(void **) ((char *) obj + cache->offset);
+}
+
+static inline void set_freeptr(struct kmem_cache *cache, void *obj, void *next) {
+    *(void **) ((char *) obj + cache->offset) = next;
+}
+
+static inline size_t slab_header_size(struct kmem_cache *cache) {
+    return ALIGN_UP(sizeof(struct slab), cache->align);
+}
+
+static inline struct slab *obj_to_slab(struct kmem_cache *cache, void *obj) {
+    return (struct slab *) ((uint64_t) obj & ~(((uint64_t) PGSIZE << cache->order) - 1));
+}
+
+// Choose the smallest slab order that fits at least one object
+// and wastes no more than an eighth of the slab.
+static void cache_estimate(struct kmem_cache *cache) {
+    for (cache->order = 0; ; cache->order++) {
+        size_t slab_bytes = (size_t) PGSIZE << cache->order;
+        size_t avail = slab_bytes - slab_header_size(cache);
+        size_t count = avail / cache->size;
+        size_t waste = avail - count * cache->size;
+
+        if (count > 0 && (waste * 8 <= slab_bytes || cache->order == SLAB_MAX_ORDER)) {
+            cache->objs_per_slab = count;
+            return;
+        }
+        if (cache->order == SLAB_MAX_ORDER) {
+            printf("kmem_cache %s: object size %d too large\n", cache->name, cache->object_size);
+            panic("kmem_cache_create");
+        }
+    }
+}
+
+static void cache_setup(struct kmem_cache *cache, char *name, size_t size, size_t align, void (*ctor)(void *)) {
+    if (align < sizeof(void *))
+        align = sizeof(void *);
+
+    cache->name = name;
+    cache->object_size = size;
+    cache->align = align;
+    cache->ctor = ctor;
+
+    // Constructed objects must keep their state while free, so the
+    // free pointer goes behind the object instead of over it.
+    size = ALIGN_UP(size, sizeof(void *));
+    cache->offset = ctor ? size : 0;
+    if (ctor || size == 0)
+        size += sizeof(void *);
+    cache->size = ALIGN_UP(size, align);
+
+    cache_estimate(cache);
+
+    init_spinlock(&cache->lock, name);
+    lst_init(&cache->partial);
+    lst_init(&cache->full);
+    lst_init(&cache->empty);
+    cache->nr_empty = 0;
+    cache->nr_slabs = 0;
+    cache->nr_active = 0;
+    lst_push(&cache_chain, &cache->link);
+}
+
+// Tag the slab's pages so kfree can tell slab objects from page blocks.
+static void slab_mark_pages(struct slab *slab, uint32_t order, int set) {
+    struct page *page = va2page(slab);
+    for (uint64_t i = 0; i < (1UL << order); i++) {
+        if (set) {
+            page[i].flags |= PG_SLAB;
+            page[i].order = order;
+        } else {
+            page[i].flags &= ~PG_SLAB;
+        }
+    }
+}
+
+static struct slab *slab_create(struct kmem_cache *cache) {
+    struct slab *slab = kalloc_order_flags(cache->order, KALLOC_NOINIT);
+    if (slab == 0)
+        return 0;
+
+    slab_mark_pages(slab, cache->order, 1);
+
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->freelist = 0;
+
+    // Thread the free list from the end so objects are handed out in address order
+    char *first = (char *) slab + slab_header_size(cache);
+    for (int i = cache->objs_per_slab - 1; i >= 0; i--) {
+        void *obj = first + i * cache->size;
+        if (cache->ctor)
+            cache->ctor(obj);
+        set_freeptr(cache, obj, slab->freelist);
+        slab->freelist = obj;
+    }
+
+    return slab;
+}
+
+// Pages held by the empty slabs caches keep around
+static uint64_t slab_count(void) {
+    uint64_t pages = 0;
+
+    for (struct list *l = cache_chain.next; l != &cache_chain; l = l->next) {
+        struct kmem_cache *cache = (struct kmem_cache *) l;
+        pages += (uint64_t) cache->nr_empty << cache->order;
+    }
+    return pages;
+}
+
+// Free empty slabs until nr pages are back
+static uint64_t slab_scan(uint64_t nr) {
+    uint64_t freed = 0;
+
+    for (struct list *l = cache_chain.next; l != &cache_chain && freed < nr; l = l->next) {
+        struct kmem_cache *cache = (struct kmem_cache *) l;
+        acquire_spinlock(&cache->lock);
+        while (cache->nr_empty > 0 && freed < nr) {
+            struct slab *slab = lst_pop(&cache->empty);
+            cache->nr_empty--;
+            cache->nr_slabs--;
+            slab_mark_pages(slab, cache->order, 0);
+            kfree_order(slab, cache->order);
+            freed += 1UL << cache->order;
+        }
+        release_spinlock(&cache->lock);
+    }
+    return freed;
+}
+
+static struct shrinker slab_shrinker = {
+    .name = "slab",
+    .count = slab_count,
+    .scan = slab_scan,
+};
+
+void kmem_cache_init(void) {
+    lst_init(&cache_chain);
+    cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), CACHE_LINE_SIZE, 0);
+    register_shrinker(&slab_shrinker);
+}
+
+struct kmem_cache *kmem_cache_create(char *name, size_t size, size_t align, void (*ctor)(void *)) {
+    struct kmem_cache *cache = kmem_cache_alloc(&cache_cache);
+    if (cache == 0)
+        return 0;
+
+    cache_setup(cache, name, size, align, ctor);
+    return cache;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+    struct slab *slab;
+
+    acquire_spinlock(&cache->lock);
+    if (!lst_empty(&cache->partial)) {
+        slab = (struct slab *) cache->partial.next;
+    } else {
+        if (!lst_empty(&cache->empty)) {
+            slab = lst_pop(&cache->empty);
+            cache->nr_empty--;
+        } else if ((slab = slab_create(cache)) == 0) {
+            release_spinlock(&cache->lock);
+            return 0;
+        } else {
+            cache->nr_slabs++;
+        }
+        lst_push(&cache->partial, slab);
+    }
+
+    void *obj = slab->freelist;
+    slab->freelist = get_freeptr(cache, obj);
+    slab->inuse++;
+    cache->nr_active++;
+
+    if (slab->inuse == cache->objs_per_slab) {
+        lst_remove(&slab->link);
+        lst_push(&cache->full, slab);
+    }
+    release_spinlock(&cache->lock);
+
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj) {
+    struct slab *slab = obj_to_slab(cache, obj);
+
+    if (slab->cache != cache) {
+        printf("Object %p does not belong to cache %s\n", obj, cache->name);
+        panic("kmem_cache_free");
+    }
+
+    acquire_spinlock(&cache->lock);
+    if (slab->inuse == cache->objs_per_slab) {
+        lst_remove(&slab->link);
+        lst_push(&cache->partial, slab);
+    }
+
+    set_freeptr(cache, obj, slab->freelist);
+    slab->freelist = obj;
+    slab->inuse--;
+    cache->nr_active--;
+
+    if (slab->inuse == 0) {
+        lst_remove(&slab->link);
+        if (cache->nr_empty < SLAB_KEEP_EMPTY) {
+            lst_push(&cache->empty, slab);
+            cache->nr_empty++;
+        } else {
+            cache->nr_slabs--;
+            slab_mark_pages(slab, cache->order, 0);
+            kfree_order(slab, cache->order);
+        }
+    }
+    release_spinlock(&cache->lock);
+}
+
+void kmem_cache_print_stats(void) {
+    uint64_t pages = 0;
+
+    printf("cache  objsize  active  total  slabs\n");
+    for (struct list *l = cache_chain.next; l != &cache_chain; l = l->next) {
+        struct kmem_cache *cache = (struct kmem_cache *) l;
+        printf("%s  %d  %d  %d  %d\n", cache->name, (int) cache->object_size, (int) cache->nr_active,
+               (int) (cache->nr_slabs * cache->objs_per_slab), (int) cache->nr_slabs);
+        pages += (uint64_t) cache->nr_slabs << cache->order;
+    }
+    printf("slab pages: %d\n", (int) pages);
+}
@@ -0,0 +1,57 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_SLAB_H
+#define UNTITLED_OS_SLAB_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "../list/list.h"
+#include "../sync/spinlock.h"
+#include "../memlayout.h"
+
+#define SLAB_MAX_ORDER 3 // slabs are at most 2^3 pages
+
+// Object cache: fixed-size objects carved out of slabs of
+// 2^order pages. The slab header sits at the start of the slab,
+// and slabs are naturally aligned, so an object's slab is found by
+// rounding its address down.
+struct kmem_cache {
+    struct list link;            // on the list of all caches
+    char *name;
+    size_t object_size;          // size requested by the user
+    size_t size;                 // object stride inside a slab
+    size_t align;
+    size_t offset;               // where the free pointer is kept
+    uint32_t order;
+    uint32_t objs_per_slab;
+    void (*ctor)(void *);
+    struct spinlock lock;
+    struct list partial;         // slabs with free and used objects
+    struct list full;
+    struct list empty;
+    uint32_t nr_empty;
+    uint32_t nr_slabs;
+    uint64_t nr_active;          // objects handed out
+};
+
+struct slab {
+    struct list link;            // on one of the cache lists
+    struct kmem_cache *cache;
+    void *freelist;
+    uint32_t inuse;
+};
+
+void kmem_cache_init(void);
+
+struct kmem_cache *kmem_cache_create(char *name, size_t size, size_t align, void (*ctor)(void *));
+
+void *kmem_cache_alloc(struct kmem_cache *cache);
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+void kmem_cache_print_stats(void);
+
+#endif //UNTITLED_OS_SLAB_H
@@ -0,0 +1,22 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_LZ4_H
+#define UNTITLED_OS_LZ4_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LZ4_HASH_LOG 12
+#define LZ4_TABLE_SIZE (1 << LZ4_HASH_LOG) // entries of the compressor's work table
+#define LZ4_MAX_INPUT 65535                // offsets are 16 bits
+
+// LZ4 block format, without the frame around it. The compressor is
+// the greedy single-probe one; table is caller-provided scratch space.
+int lz4_compress(const void *src, int len, void *dst, int cap, uint16_t *table);
+
+int lz4_decompress(const void *src, int len, void *dst, int cap);
+
+#endif //UNTITLED_OS_LZ4_H
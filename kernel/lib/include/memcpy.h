@@ -0,0 +1,11 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_MEMCPY_H
+#define UNTITLED_OS_MEMCPY_H
+#include <stdint.h>
+#include <stddef.h>
+void *memcpy(void *dst, const void *src, size_t num);
+#endif //UNTITLED_OS_MEMCPY_H
@@ -0,0 +1,70 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_RBTREE_H
+#define UNTITLED_OS_RBTREE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Intrusive red-black tree. Nodes are embedded in the user's structure
+// and the user does the ordered descent itself: find the link to hang
+// the new node on, rb_link_node() it there, then rb_insert_color()
+// restores the balance.
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+struct rb_node {
+    uintptr_t parent_color; // parent pointer, the low bit is the color
+    struct rb_node *left;
+    struct rb_node *right;
+};
+
+struct rb_root {
+    struct rb_node *node;
+};
+
+// Callbacks keeping a per-node value computed from the subtree (for
+// example the largest free gap below a node) up to date
+struct rb_augment {
+    // recompute node and its ancestors up to (not including) stop
+    void (*propagate)(struct rb_node *node, struct rb_node *stop);
+    // new takes old's place in the tree, copy the subtree value
+    void (*copy)(struct rb_node *old, struct rb_node *new);
+    // new was rotated above old, fix both values
+    void (*rotate)(struct rb_node *old, struct rb_node *new);
+};
+
+#define rb_entry(ptr, type, member) ((type *) ((char *) (ptr) - offsetof(type, member)))
+
+static inline struct rb_node *rb_parent(const struct rb_node *node) {
+    return (struct rb_node *) (node->parent_color & ~(uintptr_t) 3);
+}
+
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **link) {
+    node->parent_color = (uintptr_t) parent; // red
+    node->left = node->right = 0;
+    *link = node;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root);
+
+// The new node's own value must be set, its ancestors are updated here
+void rb_insert_augmented(struct rb_node *node, struct rb_root *root, const struct rb_augment *augment);
+
+void rb_erase(struct rb_node *node, struct rb_root *root);
+
+void rb_erase_augmented(struct rb_node *node, struct rb_root *root, const struct rb_augment *augment);
+
+struct rb_node *rb_first(const struct rb_root *root);
+
+struct rb_node *rb_last(const struct rb_root *root);
+
+struct rb_node *rb_next(const struct rb_node *node);
+
+struct rb_node *rb_prev(const struct rb_node *node);
+
+#endif //UNTITLED_OS_RBTREE_H
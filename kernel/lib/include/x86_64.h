@@ -82,6 +82,48 @@ static inline uint32_t xchg(volatile uint32_t *addr, uint32_t newval) {
 }
 
 
+static inline void
+cpuid_count(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    asm volatile("cpuid" : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx) : "a" (leaf), "c" (subleaf));
+}
+
+static inline uint64_t
+rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t) hi << 32) | lo;
+}
+
+static inline uint64_t
+rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+    return ((uint64_t) hi << 32) | lo;
+}
+
+static inline void
+wrmsr(uint32_t msr, uint64_t val) {
+    asm volatile("wrmsr" : : "c" (msr), "a" ((uint32_t) val), "d" ((uint32_t) (val >> 32)) : "memory");
+}
+
+static inline void
+wbinvd(void) {
+    asm volatile("wbinvd" : : : "memory");
+}
+
+// Drain write-combining buffers
+static inline void
+sfence(void) {
+    asm volatile("sfence" : : : "memory");
+}
+
+static inline void
+invlpg(uint64_t va) {
+    asm volatile("invlpg (%0)" : : "r" (va) : "memory");
+}
+
+#define FL_INT 0x00000200 // Interrupt Enable
+
 static inline uint32_t
 readeflags(void) {
     uint64_t eflags;
@@ -106,8 +148,19 @@ rcr3(void) {
 
 static inline void
 wcr3(uint64_t val) {
-    asm("mov %0, %%rax"::"a"(val));
-    asm("mov %rax, %cr3");
+    asm volatile("mov %0, %%cr3" : : "r" (val) : "memory");
+}
+
+static inline uint64_t
+rcr4(void) {
+    uint64_t val;
+    asm volatile("mov %%cr4,%0" : "=r" (val));
+    return val;
+}
+
+static inline void
+wcr4(uint64_t val) {
+    asm volatile("mov %0, %%cr4" : : "r" (val) : "memory");
 }
 
 
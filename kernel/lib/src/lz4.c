@@ -0,0 +1,159 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "../include/lz4.h"
+#include "../include/memcpy.h"
+#include "../include/memset.h"
+
+// A block is a run of sequences: a token with the literal length in
+// its high nibble and the match length minus 4 in the low one, longer
+// lengths continued in extra bytes of 255, the literals, and a 16-bit
+// little-endian match offset. The last sequence has literals only;
+// the last 5 bytes are always literals and no match starts in the
+// last 12.
+
+#define MINMATCH 4
+#define LASTLITERALS 5
+#define MFLIMIT 12
+
+static inline uint32_t read32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint32_t hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+// Continue a length of 15 or more in extra bytes
+static uint8_t *write_length(uint8_t *op, int n) {
+    for (n -= 15; n >= 255; n -= 255)
+        *op++ = 255;
+    *op++ = n;
+    return op;
+}
+
+static int read_length(const uint8_t **ip, const uint8_t *iend, int *n) {
+    uint8_t b;
+    do {
+        if (*ip >= iend)
+            return -1;
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+// Room for a sequence's token, lengths and literals
+static inline int sequence_size(int litlen, int matchlen) {
+    return 1 + litlen / 255 + 1 + litlen + 2 + matchlen / 255 + 1;
+}
+
+// Compress len bytes of src into at most cap bytes of dst. Returns the
+// compressed size, or 0 if it does not fit.
+int lz4_compress(const void *source, int len, void *dest, int cap, uint16_t *table) {
+    const uint8_t *src = source;
+    const uint8_t *ip = src, *anchor = src;
+    const uint8_t *end = src + len;
+    uint8_t *op = dest, *oend = (uint8_t *) dest + cap;
+
+    if (len > LZ4_MAX_INPUT)
+        return 0;
+    memset(table, 0, LZ4_TABLE_SIZE * sizeof(uint16_t));
+
+    if (len >= MFLIMIT) {
+        const uint8_t *mflimit = end - MFLIMIT;
+        const uint8_t *matchlimit = end - LASTLITERALS;
+
+        for (ip++; ip <= mflimit; ) {
+            uint32_t h = hash(read32(ip));
+            const uint8_t *ref = src + table[h];
+            table[h] = ip - src;
+            if (ref >= ip || read32(ref) != read32(ip)) {
+                ip++;
+                continue;
+            }
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t *m = ip + MINMATCH, *r = ref + MINMATCH;
+            while (m < matchlimit && *m == *r) {
+                m++;
+                r++;
+            }
+
+            int litlen = ip - anchor;
+            int matchlen = m - ip - MINMATCH;
+            if (sequence_size(litlen, matchlen) > oend - op)
+                return 0;
+
+            uint8_t *token = op++;
+            *token = (litlen < 15 ? litlen : 15) << 4;
+            if (litlen >= 15)
+                op = write_length(op, litlen);
+            memcpy(op, anchor, litlen);
+            op += litlen;
+            *op++ = (ip - ref) & 0xFF;
+            *op++ = (ip - ref) >> 8;
+            *token |= matchlen < 15 ? matchlen : 15;
+            if (matchlen >= 15)
+                op = write_length(op, matchlen);
+
+            ip = anchor = m;
+        }
+    }
+
+    int litlen = end - anchor;
+    if (sequence_size(litlen, 0) - 3 > oend - op)
+        return 0;
+    *op++ = (litlen < 15 ? litlen : 15) << 4;
+    if (litlen >= 15)
+        op = write_length(op, litlen);
+    memcpy(op, anchor, litlen);
+    op += litlen;
+
+    return op - (uint8_t *) dest;
+}
+
+// Decompress a block of len bytes into at most cap bytes of dst.
+// Returns the decompressed size, or -1 if the block is malformed.
+int lz4_decompress(const void *source, int len, void *dest, int cap) {
+    const uint8_t *ip = source, *iend = ip + len;
+    uint8_t *dst = dest, *op = dst, *oend = dst + cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        int litlen = token >> 4;
+        if (litlen == 15 && read_length(&ip, iend, &litlen) < 0)
+            return -1;
+        if (litlen > iend - ip || litlen > oend - op)
+            return -1;
+        memcpy(op, ip, litlen);
+        op += litlen;
+        ip += litlen;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        int matchlen = token & 15;
+        if (matchlen == 15 && read_length(&ip, iend, &matchlen) < 0)
+            return -1;
+        matchlen += MINMATCH;
+        if (offset == 0 || offset > op - dst || matchlen > oend - op)
+            return -1;
+
+        // Byte by byte: the match may overlap what it produces
+        const uint8_t *ref = op - offset;
+        while (matchlen-- > 0)
+            *op++ = *ref++;
+    }
+
+    return op - dst;
+}
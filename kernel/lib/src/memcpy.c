@@ -0,0 +1,19 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+
+#include "../include/memcpy.h"
+#include <inttypes.h>
+
+void *memcpy(void *dst, const void *src, size_t num) {
+    unsigned char *dst_ptr = (unsigned char *) dst;
+    const unsigned char *src_ptr = (const unsigned char *) src;
+
+    for (size_t i = 0; i < num; i++) {
+        *dst_ptr++ = *src_ptr++;
+    }
+
+    return dst;
+}
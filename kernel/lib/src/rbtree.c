@@ -0,0 +1,389 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "../include/rbtree.h"
+
+// The rebalancing follows the classic red-black rules:
+// 1) every node is red or black, 2) the root is black, 3) a red node
+// has no red children, 4) every path from a node to its leaves has the
+// same number of black nodes. Insertion fixes red-red violations going
+// up, erasure fixes a missing black going up, each with O(1) rotations.
+
+static inline int rb_is_black(const struct rb_node *node) {
+    return node->parent_color & RB_BLACK;
+}
+
+static inline int rb_is_red(const struct rb_node *node) {
+    return !rb_is_black(node);
+}
+
+static inline void rb_set_black(struct rb_node *node) {
+    node->parent_color |= RB_BLACK;
+}
+
+static inline void rb_set_parent(struct rb_node *node, struct rb_node *parent) {
+    node->parent_color = (uintptr_t) parent | (node->parent_color & RB_BLACK);
+}
+
+static inline void rb_set_parent_color(struct rb_node *node, struct rb_node *parent, int color) {
+    node->parent_color = (uintptr_t) parent | color;
+}
+
+static inline void change_child(struct rb_node *old, struct rb_node *new, struct rb_node *parent,
+                                struct rb_root *root) {
+    if (parent == 0)
+        root->node = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+}
+
+// new takes old's parent and color, old becomes new's child with color
+static inline void rotate_set_parents(struct rb_node *old, struct rb_node *new, struct rb_root *root, int color) {
+    struct rb_node *parent = rb_parent(old);
+    new->parent_color = old->parent_color;
+    rb_set_parent_color(old, new, color);
+    change_child(old, new, parent, root);
+}
+
+static void dummy_propagate(struct rb_node *node, struct rb_node *stop) {}
+static void dummy_copy(struct rb_node *old, struct rb_node *new) {}
+static void dummy_rotate(struct rb_node *old, struct rb_node *new) {}
+
+static const struct rb_augment dummy_augment = {
+    dummy_propagate, dummy_copy, dummy_rotate
+};
+
+static void insert_fixup(struct rb_node *node, struct rb_root *root,
+                         void (*rotate)(struct rb_node *, struct rb_node *)) {
+    struct rb_node *parent = rb_parent(node), *gparent, *tmp;
+
+    while (1) {
+        if (parent == 0) {
+            // The root is black
+            rb_set_parent_color(node, 0, RB_BLACK);
+            break;
+        }
+        if (rb_is_black(parent))
+            break;
+
+        gparent = rb_parent(parent);
+        tmp = gparent->right;
+        if (parent != tmp) {
+            // parent is the left child
+            if (tmp && rb_is_red(tmp)) {
+                // Red uncle: flip colors and continue from gparent
+                rb_set_parent_color(tmp, gparent, RB_BLACK);
+                rb_set_parent_color(parent, gparent, RB_BLACK);
+                node = gparent;
+                parent = rb_parent(node);
+                rb_set_parent_color(node, parent, RB_RED);
+                continue;
+            }
+
+            tmp = parent->right;
+            if (node == tmp) {
+                // Inner child: rotate left at parent to make it outer
+                tmp = node->left;
+                parent->right = tmp;
+                node->left = parent;
+                if (tmp)
+                    rb_set_parent_color(tmp, parent, RB_BLACK);
+                rb_set_parent_color(parent, node, RB_RED);
+                rotate(parent, node);
+                parent = node;
+                tmp = node->right;
+            }
+
+            // Outer child: rotate right at gparent
+            gparent->left = tmp;
+            parent->right = gparent;
+            if (tmp)
+                rb_set_parent_color(tmp, gparent, RB_BLACK);
+            rotate_set_parents(gparent, parent, root, RB_RED);
+            rotate(gparent, parent);
+            break;
+        } else {
+            // Mirror image: parent is the right child
+            tmp = gparent->left;
+            if (tmp && rb_is_red(tmp)) {
+                rb_set_parent_color(tmp, gparent, RB_BLACK);
+                rb_set_parent_color(parent, gparent, RB_BLACK);
+                node = gparent;
+                parent = rb_parent(node);
+                rb_set_parent_color(node, parent, RB_RED);
+                continue;
+            }
+
+            tmp = parent->left;
+            if (node == tmp) {
+                tmp = node->right;
+                parent->left = tmp;
+                node->right = parent;
+                if (tmp)
+                    rb_set_parent_color(tmp, parent, RB_BLACK);
+                rb_set_parent_color(parent, node, RB_RED);
+                rotate(parent, node);
+                parent = node;
+                tmp = node->left;
+            }
+
+            gparent->right = tmp;
+            parent->left = gparent;
+            if (tmp)
+                rb_set_parent_color(tmp, gparent, RB_BLACK);
+            rotate_set_parents(gparent, parent, root, RB_RED);
+            rotate(gparent, parent);
+            break;
+        }
+    }
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root) {
+    insert_fixup(node, root, dummy_rotate);
+}
+
+void rb_insert_augmented(struct rb_node *node, struct rb_root *root, const struct rb_augment *augment) {
+    augment->propagate(rb_parent(node), 0);
+    insert_fixup(node, root, augment->rotate);
+}
+
+// Unlink node and return the parent below which one black is missing,
+// or 0 if the tree is still balanced
+static struct rb_node *erase_node(struct rb_node *node, struct rb_root *root, const struct rb_augment *augment) {
+    struct rb_node *child = node->right, *tmp = node->left;
+    struct rb_node *parent, *rebalance;
+    uintptr_t pc;
+
+    if (tmp == 0) {
+        // At most a right child, which takes node's place
+        pc = node->parent_color;
+        parent = (struct rb_node *) (pc & ~(uintptr_t) 3);
+        change_child(node, child, parent, root);
+        if (child) {
+            child->parent_color = pc;
+            rebalance = 0;
+        } else {
+            rebalance = (pc & RB_BLACK) ? parent : 0;
+        }
+        tmp = parent;
+    } else if (child == 0) {
+        // Only a left child, necessarily red with a black node above
+        tmp->parent_color = pc = node->parent_color;
+        parent = (struct rb_node *) (pc & ~(uintptr_t) 3);
+        change_child(node, tmp, parent, root);
+        rebalance = 0;
+        tmp = parent;
+    } else {
+        // Two children: the in-order successor takes node's place
+        struct rb_node *successor = child, *child2;
+
+        tmp = child->left;
+        if (tmp == 0) {
+            // The successor is the right child
+            parent = successor;
+            child2 = successor->right;
+            augment->copy(node, successor);
+        } else {
+            // The successor is the leftmost node of the right subtree
+            do {
+                parent = successor;
+                successor = tmp;
+                tmp = tmp->left;
+            } while (tmp);
+            child2 = successor->right;
+            parent->left = child2;
+            successor->right = child;
+            rb_set_parent(child, successor);
+            augment->copy(node, successor);
+            augment->propagate(parent, successor);
+        }
+
+        tmp = node->left;
+        successor->left = tmp;
+        rb_set_parent(tmp, successor);
+
+        pc = node->parent_color;
+        tmp = (struct rb_node *) (pc & ~(uintptr_t) 3);
+        change_child(node, successor, tmp, root);
+
+        if (child2) {
+            rb_set_parent_color(child2, parent, RB_BLACK);
+            rebalance = 0;
+        } else {
+            rebalance = rb_is_black(successor) ? parent : 0;
+        }
+        successor->parent_color = pc;
+        tmp = successor;
+    }
+
+    augment->propagate(tmp, 0);
+    return rebalance;
+}
+
+static void erase_fixup(struct rb_node *parent, struct rb_root *root,
+                        void (*rotate)(struct rb_node *, struct rb_node *)) {
+    struct rb_node *node = 0, *sibling, *tmp1, *tmp2;
+
+    while (1) {
+        // node is black (or null) and one black short of its sibling
+        sibling = parent->right;
+        if (node != sibling) {
+            // node is the left child
+            if (rb_is_red(sibling)) {
+                // Red sibling: rotate left at parent to get a black one
+                tmp1 = sibling->left;
+                parent->right = tmp1;
+                sibling->left = parent;
+                rb_set_parent_color(tmp1, parent, RB_BLACK);
+                rotate_set_parents(parent, sibling, root, RB_RED);
+                rotate(parent, sibling);
+                sibling = tmp1;
+            }
+            tmp1 = sibling->right;
+            if (tmp1 == 0 || rb_is_black(tmp1)) {
+                tmp2 = sibling->left;
+                if (tmp2 == 0 || rb_is_black(tmp2)) {
+                    // Black nephews: recolor the sibling and move up
+                    rb_set_parent_color(sibling, parent, RB_RED);
+                    if (rb_is_red(parent)) {
+                        rb_set_black(parent);
+                    } else {
+                        node = parent;
+                        parent = rb_parent(node);
+                        if (parent)
+                            continue;
+                    }
+                    break;
+                }
+                // Inner nephew red: rotate right at sibling
+                tmp1 = tmp2->right;
+                sibling->left = tmp1;
+                tmp2->right = sibling;
+                parent->right = tmp2;
+                if (tmp1)
+                    rb_set_parent_color(tmp1, sibling, RB_BLACK);
+                rotate(sibling, tmp2);
+                tmp1 = sibling;
+                sibling = tmp2;
+            }
+            // Outer nephew red: rotate left at parent and recolor
+            tmp2 = sibling->left;
+            parent->right = tmp2;
+            sibling->left = parent;
+            rb_set_parent_color(tmp1, sibling, RB_BLACK);
+            if (tmp2)
+                rb_set_parent(tmp2, parent);
+            rotate_set_parents(parent, sibling, root, RB_BLACK);
+            rotate(parent, sibling);
+            break;
+        } else {
+            // Mirror image: node is the right child
+            sibling = parent->left;
+            if (rb_is_red(sibling)) {
+                tmp1 = sibling->right;
+                parent->left = tmp1;
+                sibling->right = parent;
+                rb_set_parent_color(tmp1, parent, RB_BLACK);
+                rotate_set_parents(parent, sibling, root, RB_RED);
+                rotate(parent, sibling);
+                sibling = tmp1;
+            }
+            tmp1 = sibling->left;
+            if (tmp1 == 0 || rb_is_black(tmp1)) {
+                tmp2 = sibling->right;
+                if (tmp2 == 0 || rb_is_black(tmp2)) {
+                    rb_set_parent_color(sibling, parent, RB_RED);
+                    if (rb_is_red(parent)) {
+                        rb_set_black(parent);
+                    } else {
+                        node = parent;
+                        parent = rb_parent(node);
+                        if (parent)
+                            continue;
+                    }
+                    break;
+                }
+                tmp1 = tmp2->left;
+                sibling->right = tmp1;
+                tmp2->left = sibling;
+                parent->left = tmp2;
+                if (tmp1)
+                    rb_set_parent_color(tmp1, sibling, RB_BLACK);
+                rotate(sibling, tmp2);
+                tmp1 = sibling;
+                sibling = tmp2;
+            }
+            tmp2 = sibling->right;
+            parent->left = tmp2;
+            sibling->right = parent;
+            rb_set_parent_color(tmp1, sibling, RB_BLACK);
+            if (tmp2)
+                rb_set_parent(tmp2, parent);
+            rotate_set_parents(parent, sibling, root, RB_BLACK);
+            rotate(parent, sibling);
+            break;
+        }
+    }
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *rebalance = erase_node(node, root, &dummy_augment);
+    if (rebalance)
+        erase_fixup(rebalance, root, dummy_rotate);
+}
+
+void rb_erase_augmented(struct rb_node *node, struct rb_root *root, const struct rb_augment *augment) {
+    struct rb_node *rebalance = erase_node(node, root, augment);
+    if (rebalance)
+        erase_fixup(rebalance, root, augment->rotate);
+}
+
+struct rb_node *rb_first(const struct rb_root *root) {
+    struct rb_node *node = root->node;
+    if (node == 0)
+        return 0;
+    while (node->left)
+        node = node->left;
+    return node;
+}
+
+struct rb_node *rb_last(const struct rb_root *root) {
+    struct rb_node *node = root->node;
+    if (node == 0)
+        return 0;
+    while (node->right)
+        node = node->right;
+    return node;
+}
+
+struct rb_node *rb_next(const struct rb_node *node) {
+    struct rb_node *parent;
+
+    if (node->right) {
+        node = node->right;
+        while (node->left)
+            node = node->left;
+        return (struct rb_node *) node;
+    }
+    while ((parent = rb_parent(node)) && node == parent->right)
+        node = parent;
+    return parent;
+}
+
+struct rb_node *rb_prev(const struct rb_node *node) {
+    struct rb_node *parent;
+
+    if (node->left) {
+        node = node->left;
+        while (node->right)
+            node = node->right;
+        return (struct rb_node *) node;
+    }
+    while ((parent = rb_parent(node)) && node == parent->left)
+        node = parent;
+    return parent;
+}
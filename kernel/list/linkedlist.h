@@ -1,7 +1,7 @@
 #ifndef LINKEDlistH
 #define LINKEDlistH
 
-#include "../kalloc/kalloc.h"
+#include "../kalloc/kmalloc.h"
 
 #include "../lib/include/types.h"
 #define LINKEDLIST_GENERATE(PFX, NAME, DATA_TYPE)    \
@@ -42,7 +42,7 @@
                                                                                     \
     NAME *PFX##_new(void)                                                     \
     {                                                                               \
-        NAME *new_list = kalloc();                                      \
+        NAME *new_list = kmalloc(sizeof(NAME));                         \
                                                                                     \
         if (!new_list)                                                                \
             return NULL;                                                            \
@@ -277,7 +277,7 @@
                                                                                     \
     FMOD NAME##_node *PFX##_new_node(NAME *_owner_, DATA_TYPE element)                    \
     {                                                                               \
-        NAME##_node *node = malloc(sizeof(NAME##_node));                          \
+        NAME##_node *node = kmalloc(sizeof(NAME##_node));                         \
                                                                                     \
         if (!node)                                                                  \
             return NULL;                                                            \
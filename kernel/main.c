@@ -7,12 +7,26 @@
 #include "idt/idt.h"
 #include "tty/tty.h"
 #include "kalloc/kalloc.h"
+#include "kalloc/slab.h"
+#include "kalloc/kmalloc.h"
 #include "memlayout.h"
+#include "memmap/memmap.h"
 #include "lib/include/x86_64.h"
 #include "paging/paging.h"
 #include "sched/proc.h"
 #include "sched/threads.h"
 #include "sched/scheduler.h"
+#include "sched/runqueue.h"
+#include "sync/mutex.h"
+#include "bench/bench.h"
+#include "gdt/gdt.h"
+#include "vm/vm.h"
+#include "paging/tlb.h"
+#include "apic/lapic.h"
+#include "vm/swap.h"
+#include "vm/reclaim.h"
+#include "acpi/acpi.h"
+#include "apic/smp.h"
 
 
 
@@ -29,7 +43,8 @@ void thread_function(int argc, struct argument *args) {
 
 
 
-int kernel_main(){
+int kernel_main(uint64_t multiboot_info){
+    percpu_init(0);
     init_tty();
     
     for (uint8_t i=0; i < TERMINALS_NUMBER; i++) {
@@ -45,22 +60,54 @@ int kernel_main(){
     printf("Kernel end at address: %d\n", KEND);
     printf("Kernel size: %d\n", KEND - KSTART);
 
-    kinit(KEND, INIT_PHYSTOP);
-    pagetable_t kernel_table = kvminit(INIT_PHYSTOP, PHYSTOP);
+    memmap_init(multiboot_info);
+    printf("Physical memory map:\n");
+    memmap_print();
+
+    pat_init();
+
+    pagetable_t kernel_table = kvminit(INIT_PHYSTOP, (uint64_t) -1);
     printf("kernel table: %p\n", kernel_table);
-    kinit(INIT_PHYSTOP, PHYSTOP);
-    printf("Successfully allocated physical memory up to %p\n", PHYSTOP);
+    pcid_init();
+    tlb_init();
+    kinit();
+    printf("Successfully allocated physical memory up to %p\n", phys_top);
     printf("%d pages available in allocator\n", count_pages());
+    reclaim_init();
+    kmem_cache_init();
+    kmalloc_init();
+    mutexinit();
+    vm_init();
+    swap_init();
+    vga_map_wc();
+    lapic_init();
+    rq_init();
+
+#ifdef SHIPOS_BENCH
+    run_benchmarks();
+#endif
+
+    // Interrupts are on from here. The timer finds nothing to run until
+    // procinit, and the other CPUs idle in scheduler() until then too.
+    gdt_init();
+    setup_idt();
+    acpi_init();
+    smp_init();
 
     struct proc_node *init_proc_node = procinit();
     printf("Init proc node %p\n", init_proc_node);
     struct thread *init_thread = peek_thread_list(init_proc_node->data->threads);
     printf("Got init thread\n");
 
-    setup_idt();
-
-    //scheduler();
+#ifdef SHIPOS_BENCH
+    run_smp_benchmarks();
+#endif
 
-    while(1) {};
+    // Idle: reclaim below the low watermark, keep the pre-zeroed page
+    // pool topped up, then look for heap chunks to back with huge pages
+    while(1) {
+        if (!reclaim_idle() && !kalloc_zero_idle())
+            thp_scan();
+    }
     return 0;
 }
\ No newline at end of file
@@ -1,15 +1,41 @@
-// Kernel starts at 0x100000 (1mb)
-// And ends at symbol end
-#define KSTART 0x100000
+// The kernel image is loaded at 0x100000 (1mb) and linked KERNBASE
+// above that, see linker.ld. It ends at symbol end
+#define KERNBASE 0xFFFFFFFF80000000UL
+#define KSTART (KERNBASE + 0x100000)
 extern char end[]; // first address after kernel
                    // defined in linked.ld
 #define KEND end
 
-#define INIT_PHYSTOP 2*1024*1024      // Initial entry pagetable capacity
-#define PHYSTOP 128*1024*1024          // Top physical memory
+// All of physical memory is mapped at PHYS_BASE, so kernel code reaches
+// any frame (page tables, kalloc blocks, boot data) by a constant offset.
+// Addresses inside the kernel image are converted with KERN_TO_PHYS.
+#define PHYS_BASE 0xFFFF800000000000UL
+#define PHYS_TO_VIRT(pa) ((void *) ((uint64_t) (pa) + PHYS_BASE))
+#define VIRT_TO_PHYS(va) ((uint64_t) (va) - PHYS_BASE)
+#define KERN_TO_PHYS(va) ((uint64_t) (va) - KERNBASE)
+
+#define INIT_PHYSTOP 0x40000000      // Initial direct map capacity (1 GiB
+                                      // of 2 MiB pages, see boot.asm)
+                                      // Top of physical memory comes from
+                                      // the bootloader, see memmap/memmap.h
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
 
+#define LARGE_PGSIZE 0x200000  // 2 MiB page mapped by a PDE
+#define HUGE_PGSIZE 0x40000000 // 1 GiB page mapped by a PDPTE
+
+#define CACHE_LINE_SIZE 64 // bytes per cache line
+
+// Kernel virtual area for thread stacks and other mappings backed on
+// demand. It is one PML4 slot shared by every address space, see vm/vm.c
+#define KVM_BASE 0xFFFFFE8000000000UL
+#define KVM_END  0xFFFFFF0000000000UL
+
+// Private part of a process address space: the whole lower canonical
+// half but the null page. The heap grows up from UVM_BASE with sbrk
+#define UVM_BASE 0x0000000000001000UL
+#define UVM_END  0x0000800000000000UL
+
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
\ No newline at end of file
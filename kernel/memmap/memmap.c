@@ -0,0 +1,177 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "memmap.h"
+#include "multiboot.h"
+#include "../memlayout.h"
+#include "../tty/tty.h"
+#include "../lib/include/panic.h"
+#include "../lib/include/memcpy.h"
+
+struct phys_region phys_regions[MAX_PHYS_REGIONS];
+int nr_phys_regions;
+uint64_t phys_top;
+struct boot_framebuffer boot_framebuffer;
+struct boot_rsdp boot_rsdp;
+
+static char *region_names[] = {
+    [PHYS_USABLE] = "usable",
+    [PHYS_RESERVED] = "reserved",
+    [PHYS_ACPI_RECLAIMABLE] = "ACPI",
+    [PHYS_ACPI_NVS] = "ACPI NVS",
+    [PHYS_BAD] = "bad"
+};
+
+static void insert_region(uint64_t base, uint64_t end, enum phys_region_type type) {
+    if (nr_phys_regions == MAX_PHYS_REGIONS) {
+        printf("memmap: dropping region %p-%p\n", base, end);
+        return;
+    }
+
+    // Keep the table sorted by base address
+    int i = nr_phys_regions++;
+    while (i > 0 && phys_regions[i - 1].base > base) {
+        phys_regions[i] = phys_regions[i - 1];
+        i--;
+    }
+    phys_regions[i].base = base;
+    phys_regions[i].length = end - base;
+    phys_regions[i].type = type;
+}
+
+// Add the part of [base, end) not covered by any region already in
+// the table, so reserved ranges always win over usable ones.
+static void add_usable(uint64_t base, uint64_t end) {
+    for (int i = 0; i < nr_phys_regions && base < end; i++) {
+        uint64_t rbase = phys_regions[i].base;
+        uint64_t rend = rbase + phys_regions[i].length;
+        if (base < rend && rbase < end) {
+            add_usable(base, rbase);
+            add_usable(rend, end);
+            return;
+        }
+    }
+    if (base < end)
+        insert_region(base, end, PHYS_USABLE);
+}
+
+static enum phys_region_type region_type(uint32_t multiboot_type) {
+    switch (multiboot_type) {
+        case MULTIBOOT_MEMORY_AVAILABLE:
+            return PHYS_USABLE;
+        case MULTIBOOT_MEMORY_ACPI_RECLAIMABLE:
+            return PHYS_ACPI_RECLAIMABLE;
+        case MULTIBOOT_MEMORY_NVS:
+            return PHYS_ACPI_NVS;
+        case MULTIBOOT_MEMORY_BADRAM:
+            return PHYS_BAD;
+        default:
+            return PHYS_RESERVED;
+    }
+}
+
+static void parse_mmap(struct multiboot_tag_mmap *tag, int pass) {
+    char *entry = (char *) tag->entries;
+    char *tag_end = (char *) tag + tag->size;
+
+    for (; entry < tag_end; entry += tag->entry_size) {
+        struct multiboot_mmap_entry *e = (struct multiboot_mmap_entry *) entry;
+        enum phys_region_type type = region_type(e->type);
+        if (e->len == 0)
+            continue;
+
+        // Reserved ranges are rounded out, usable ones in
+        if (pass == 0 && type != PHYS_USABLE)
+            insert_region(PGROUNDDOWN(e->addr), PGROUNDUP(e->addr + e->len), type);
+        if (pass == 1 && type == PHYS_USABLE)
+            add_usable(PGROUNDUP(e->addr), PGROUNDDOWN(e->addr + e->len));
+    }
+}
+
+void memmap_init(uint64_t multiboot_info) {
+    struct multiboot_info *info = PHYS_TO_VIRT(multiboot_info);
+    struct multiboot_tag_mmap *mmap = 0;
+    struct multiboot_tag_basic_meminfo *meminfo = 0;
+
+    char *tag = (char *) info + sizeof(struct multiboot_info);
+    char *info_end = (char *) info + info->total_size;
+    while (tag < info_end) {
+        struct multiboot_tag *t = (struct multiboot_tag *) tag;
+        if (t->type == MULTIBOOT_TAG_TYPE_END)
+            break;
+        if (t->type == MULTIBOOT_TAG_TYPE_MMAP)
+            mmap = (struct multiboot_tag_mmap *) t;
+        if (t->type == MULTIBOOT_TAG_TYPE_BASIC_MEMINFO)
+            meminfo = (struct multiboot_tag_basic_meminfo *) t;
+        if (t->type == MULTIBOOT_TAG_TYPE_FRAMEBUFFER) {
+            struct multiboot_tag_framebuffer *fb = (struct multiboot_tag_framebuffer *) t;
+            boot_framebuffer.addr = fb->framebuffer_addr;
+            boot_framebuffer.pitch = fb->framebuffer_pitch;
+            boot_framebuffer.width = fb->framebuffer_width;
+            boot_framebuffer.height = fb->framebuffer_height;
+            boot_framebuffer.bpp = fb->framebuffer_bpp;
+            boot_framebuffer.type = fb->framebuffer_type;
+        }
+        // Prefer the newer RSDP, it may point to the 64-bit XSDT
+        if (t->type == MULTIBOOT_TAG_TYPE_ACPI_NEW ||
+            (t->type == MULTIBOOT_TAG_TYPE_ACPI_OLD && boot_rsdp.size == 0)) {
+            struct multiboot_tag_acpi *acpi = (struct multiboot_tag_acpi *) t;
+            uint32_t size = t->size - sizeof(struct multiboot_tag_acpi);
+            if (size > BOOT_RSDP_MAX)
+                size = BOOT_RSDP_MAX;
+            memcpy(boot_rsdp.data, acpi->rsdp, size);
+            boot_rsdp.size = size;
+        }
+        tag += (t->size + MULTIBOOT_TAG_ALIGN - 1) & ~(MULTIBOOT_TAG_ALIGN - 1);
+    }
+
+    // The kernel image and everything below it is never handed out
+    insert_region(0, PGROUNDUP(KERN_TO_PHYS(KEND)), PHYS_RESERVED);
+
+    if (mmap) {
+        parse_mmap(mmap, 0);
+        parse_mmap(mmap, 1);
+    } else if (meminfo) {
+        add_usable(0x100000, PGROUNDDOWN(0x100000 + (uint64_t) meminfo->mem_upper * 1024));
+    } else {
+        panic("memmap: no memory information from the bootloader");
+    }
+
+    phys_top = 0;
+    for (int i = 0; i < nr_phys_regions; i++) {
+        struct phys_region *r = &phys_regions[i];
+        if (r->type == PHYS_USABLE && r->base + r->length > phys_top)
+            phys_top = r->base + r->length;
+    }
+}
+
+// Boot-time bump allocator for memory that is never freed (page
+// tables built before kinit, the page metadata array). Allocations
+// are carved off the front of the lowest usable region that fits
+// them, so whatever is still marked usable afterwards is free.
+// Returns a direct map address; before kvminit only the first
+// INIT_PHYSTOP bytes are mapped.
+void *memmap_early_alloc(uint64_t size) {
+    size = PGROUNDUP(size);
+
+    for (int i = 0; i < nr_phys_regions; i++) {
+        struct phys_region *r = &phys_regions[i];
+        if (r->type != PHYS_USABLE || r->length < size)
+            continue;
+        void *p = PHYS_TO_VIRT(r->base);
+        r->base += size;
+        r->length -= size;
+        return p;
+    }
+
+    return 0;
+}
+
+void memmap_print(void) {
+    for (int i = 0; i < nr_phys_regions; i++) {
+        struct phys_region *r = &phys_regions[i];
+        printf("  %p-%p %s\n", r->base, r->base + r->length, region_names[r->type]);
+    }
+}
@@ -0,0 +1,62 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_MEMMAP_H
+#define UNTITLED_OS_MEMMAP_H
+
+#include <inttypes.h>
+
+#define MAX_PHYS_REGIONS 128
+
+enum phys_region_type {
+    PHYS_USABLE = 1,
+    PHYS_RESERVED,
+    PHYS_ACPI_RECLAIMABLE,
+    PHYS_ACPI_NVS,
+    PHYS_BAD
+};
+
+// A page-aligned range of physical memory. Usable regions never
+// overlap each other, any other region or the kernel image.
+struct phys_region {
+    uint64_t base;
+    uint64_t length;
+    enum phys_region_type type;
+};
+
+extern struct phys_region phys_regions[];
+extern int nr_phys_regions;
+extern uint64_t phys_top; // end of the highest usable region
+
+// The screen the bootloader left us, addr is 0 if it said nothing
+struct boot_framebuffer {
+    uint64_t addr;  // physical
+    uint32_t pitch; // bytes per line
+    uint32_t width;
+    uint32_t height;
+    uint8_t bpp;
+    uint8_t type;   // MULTIBOOT_FRAMEBUFFER_TYPE_*
+};
+
+extern struct boot_framebuffer boot_framebuffer;
+
+#define BOOT_RSDP_MAX 36 // size of an ACPI 2.0 RSDP
+
+// The ACPI RSDP the bootloader copied out of the firmware, size is 0
+// if it did not
+struct boot_rsdp {
+    uint32_t size;
+    uint8_t data[BOOT_RSDP_MAX];
+};
+
+extern struct boot_rsdp boot_rsdp;
+
+void memmap_init(uint64_t multiboot_info);
+
+void *memmap_early_alloc(uint64_t size);
+
+void memmap_print(void);
+
+#endif //UNTITLED_OS_MEMMAP_H
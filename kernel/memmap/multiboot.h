@@ -0,0 +1,85 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_MULTIBOOT_H
+#define UNTITLED_OS_MULTIBOOT_H
+
+#include <inttypes.h>
+
+// Multiboot2 boot information, as handed over by GRUB in ebx.
+// https://www.gnu.org/software/grub/manual/multiboot2/multiboot.html
+
+#define MULTIBOOT_TAG_ALIGN 8
+
+#define MULTIBOOT_TAG_TYPE_END 0
+#define MULTIBOOT_TAG_TYPE_BASIC_MEMINFO 4
+#define MULTIBOOT_TAG_TYPE_MMAP 6
+#define MULTIBOOT_TAG_TYPE_FRAMEBUFFER 8
+#define MULTIBOOT_TAG_TYPE_ACPI_OLD 14
+#define MULTIBOOT_TAG_TYPE_ACPI_NEW 15
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+#define MULTIBOOT_MEMORY_RESERVED 2
+#define MULTIBOOT_MEMORY_ACPI_RECLAIMABLE 3
+#define MULTIBOOT_MEMORY_NVS 4
+#define MULTIBOOT_MEMORY_BADRAM 5
+
+#define MULTIBOOT_FRAMEBUFFER_TYPE_INDEXED 0
+#define MULTIBOOT_FRAMEBUFFER_TYPE_RGB 1
+#define MULTIBOOT_FRAMEBUFFER_TYPE_EGA_TEXT 2
+
+struct multiboot_info {
+    uint32_t total_size;
+    uint32_t reserved;
+};
+
+struct multiboot_tag {
+    uint32_t type;
+    uint32_t size;
+};
+
+struct multiboot_tag_basic_meminfo {
+    uint32_t type;
+    uint32_t size;
+    uint32_t mem_lower; // KiB below 1 MiB
+    uint32_t mem_upper; // KiB above 1 MiB
+};
+
+struct __attribute__((packed)) multiboot_mmap_entry {
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+    uint32_t zero;
+};
+
+struct multiboot_tag_mmap {
+    uint32_t type;
+    uint32_t size;
+    uint32_t entry_size;
+    uint32_t entry_version;
+    struct multiboot_mmap_entry entries[0];
+};
+
+// Followed by type-specific color information we do not use
+struct multiboot_tag_framebuffer {
+    uint32_t type;
+    uint32_t size;
+    uint64_t framebuffer_addr;
+    uint32_t framebuffer_pitch;  // bytes per line
+    uint32_t framebuffer_width;  // pixels, or characters in text mode
+    uint32_t framebuffer_height;
+    uint8_t framebuffer_bpp;
+    uint8_t framebuffer_type;
+    uint16_t reserved;
+};
+
+// A copy of the ACPI RSDP, version 1 in ACPI_OLD, 2 and later in ACPI_NEW
+struct multiboot_tag_acpi {
+    uint32_t type;
+    uint32_t size;
+    uint8_t rsdp[0];
+};
+
+#endif //UNTITLED_OS_MULTIBOOT_H
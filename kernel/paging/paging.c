@@ -10,6 +10,13 @@
 #include "../lib/include/memset.h"
 #include "../memlayout.h"
 #include "../lib/include/x86_64.h"
+#include "../memmap/memmap.h"
+#include "../lib/include/panic.h"
+#include "tlb.h"
+#include "../vm/swap.h"
+
+pagetable_t kernel_pagetable; // the boot table, shared by every address space
+bool pcid_enabled;
 
 page_entry_raw encode_page_entry(struct page_entry entry) {
 
@@ -22,11 +29,11 @@ page_entry_raw encode_page_entry(struct page_entry entry) {
     raw |= (entry.pcd & 0x1) << 4;
     raw |= (entry.a & 0x1) << 5;
     raw |= (entry.d & 0x1) << 6;
-    raw |= (entry.rsvd & 0x1) << 7;
+    raw |= (entry.ps & 0x1) << 7;
     raw |= (entry.ign1 & 0xF) << 8;
     raw |= (entry.address & 0xFFFFFFFFF) << 12;
-    raw |= (entry.ign2 & 0x7FFF) << 48;
-    raw |= (entry.xd & 0x1) << 63;
+    raw |= (uint64_t) (entry.ign2 & 0x7FFF) << 48;
+    raw |= (uint64_t) (entry.xd & 0x1) << 63;
 
     return raw;
 
@@ -42,7 +49,7 @@ struct page_entry decode_page_entry(page_entry_raw raw) {
     entry.pcd = (raw >> 4) & 0x1;
     entry.a = (raw >> 5) & 0x1;
     entry.d = (raw >> 6) & 0x1;
-    entry.rsvd = (raw >> 7) & 0x1;
+    entry.ps = (raw >> 7) & 0x1;
     entry.ign1 = (raw >> 8) & 0xF;
     entry.address = (raw >> 12) & 0xFFFFFFFFF;
     entry.ign2 = (raw >> 48) & 0x7FFF;
@@ -52,7 +59,7 @@ struct page_entry decode_page_entry(page_entry_raw raw) {
 }
 
 void print_entry(struct page_entry *entry) {
-    printf("P: %d RW: %d US: %d PWT: %d A: %d D: %d ADDR: %p\n", entry->p, entry->rw, entry->us, entry->pwt, entry->a, entry->d, entry->address << 12);
+    printf("P: %d RW: %d US: %d PWT: %d A: %d D: %d PS: %d ADDR: %p\n", entry->p, entry->rw, entry->us, entry->pwt, entry->a, entry->d, entry->ps, entry->address << 12);
 }
 
 void do_print_vm(pagetable_t tbl, int level) {
@@ -64,7 +71,7 @@ void do_print_vm(pagetable_t tbl, int level) {
                 print(".. ");
             }
             print_entry(&entry);
-            if (level > 1) do_print_vm(entry.address << 12, level-1);
+            if (level > 1 && !entry.ps) do_print_vm(PHYS_TO_VIRT(entry.address << 12), level-1);
         }
     }
 }
@@ -75,69 +82,415 @@ void print_vm(pagetable_t tbl) {
 
 
 // Pass in address to raw entry to initialize
-// and the full address (will be cut to 36 bits inside the function)
+// and the full address (will be cut to 36 bits inside the function).
+// The page is mapped write-back, use map_range for other memory types
 void init_entry(page_entry_raw *raw_entry, uint64_t addr) {
-    struct page_entry entry;
+    *raw_entry = make_pte(addr, PTE_P | PTE_W);
+}
 
-    entry.p = 1;    
-    entry.rw = 1;
-    entry.us = 0;
-    entry.pwt = 0;
-    entry.pcd = 0;
-    entry.a = 0;
-    entry.d = 0;
-    entry.rsvd = 0;
-    entry.ign1 = 0;
-    entry.address = (addr >> 12) & 0xFFFFFFFFF;
-    entry.ign2 = 0;
-    entry.xd = 0;
-
-    *raw_entry = encode_page_entry(entry);
-}
-
-struct page_entry_raw *walk(pagetable_t tbl, uint64_t va, bool alloc) {
-    for (int level = 3; level > 0; level--) {
-        int level_index = (va >> (12 + level * 9)) & 0x1FF;
-        // printf("VA: %p TBL: %p LEVEL: %d INDEX: %d\n", va, tbl, level, level_index);
-        page_entry_raw *entry_raw = &tbl[level_index];
-        struct page_entry entry = decode_page_entry(*entry_raw);
-        // print_entry(&entry);
+// Same for a PDE/PDPTE mapping a 2 MiB/1 GiB page at addr
+void init_large_entry(page_entry_raw *raw_entry, uint64_t addr) {
+    *raw_entry = make_pte(addr, PTE_P | PTE_W | PTE_PS);
+}
 
-        if (entry.p) {
-            // printf("PRESENT, CONTINUE\n");
-            tbl = entry.address << 12;
-        } else {
-            // printf("NOT PRESENT, ALLOC NEW TABLE\n");
-            if (alloc == 0 || (tbl = kalloc()) == 0) {
+// Page-table pages come from the boot allocator until kinit has run
+static pagetable_t alloc_table(void) {
+    if (kalloc_ready())
+        return kalloc_flags(KALLOC_ZERO);
+
+    pagetable_t tbl = memmap_early_alloc(PGSIZE);
+    if (tbl)
+        memset(tbl, 0, PGSIZE);
+    return tbl;
+}
+
+// Tables found by the previous walk. tbl[l] is the level-l table
+// covering addresses with va >> shift(l + 1) == tag[l], so walking the
+// next address of a range only descends from the first level that differs.
+struct walk_cache {
+    pagetable_t root;
+    pagetable_t tbl[3];
+    uint64_t tag[3];
+};
+
+static page_entry_raw *cached_walk(struct walk_cache *wc, uint64_t va, int level, bool alloc, int *found) {
+    pagetable_t tbl = wc->root;
+    int l = 3;
+
+    for (int k = level; k < 3; k++) {
+        if (wc->tbl[k] && wc->tag[k] == va >> PX_SHIFT(k + 1)) {
+            tbl = wc->tbl[k];
+            l = k;
+            break;
+        }
+    }
+
+    for (; l > level; l--) {
+        page_entry_raw *entry = &tbl[PX(l, va)];
+        if (!pte_present(*entry)) {
+            pagetable_t new;
+            if (!alloc || (new = alloc_table()) == 0) {
+                *found = l;
                 return 0;
             }
-            // printf("Allocated page at %p\n", tbl);
-            memset(tbl, 0, PGSIZE);
-            init_entry(entry_raw, (uint64_t)tbl);
+            *entry = make_pte(VIRT_TO_PHYS(new), PTE_P | PTE_W);
+        } else if (l < 3 && pte_large(*entry)) {
+            // No table can hang below a large page
+            *found = l;
+            return alloc ? 0 : entry;
+        }
+        tbl = pte_table(*entry);
+        wc->tbl[l - 1] = tbl;
+        wc->tag[l - 1] = va >> PX_SHIFT(l);
+    }
+
+    *found = level;
+    return &tbl[PX(level, va)];
+}
+
+// Return the entry for va in the table at the given level (PT_LEVEL,
+// PD_LEVEL or PDPT_LEVEL), allocating missing tables on the way.
+// Without alloc a large page met above that level is returned instead,
+// check PS; with alloc it makes the walk fail.
+page_entry_raw *walk_level(pagetable_t tbl, uint64_t va, int level, bool alloc) {
+    struct walk_cache wc = { .root = tbl };
+    int found;
+    return cached_walk(&wc, va, level, alloc, &found);
+}
+
+// Returns the PTE for va, or the PDE/PDPTE if va lies in a large page
+page_entry_raw *walk(pagetable_t tbl, uint64_t va, bool alloc) {
+    return walk_level(tbl, va, PT_LEVEL, alloc);
+}
+
+// 1 GiB pages need CPUID.80000001H:EDX.Page1GB
+static bool has_gbpages(void) {
+    static int gbpages = -1;
+    uint32_t eax, ebx, ecx, edx;
+
+    if (gbpages < 0) {
+        cpuid_count(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+        gbpages = 0;
+        if (eax >= 0x80000001) {
+            cpuid_count(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+            gbpages = (edx >> 26) & 1;
         }
     }
+    return gbpages;
+}
+
+// Put a large page at va if the slot is free or already large
+static bool map_large(struct walk_cache *wc, uint64_t va, uint64_t pa, int level, uint64_t flags) {
+    int found;
+    page_entry_raw *entry = cached_walk(wc, va, level, 1, &found);
+    if (entry == 0 || (pte_present(*entry) && !pte_large(*entry)))
+        return 0;
+    *entry = make_pte(pa, flags | PTE_PS);
+    return 1;
+}
+
+// Map [va, va + len) to pa with the given PTE flags, PTE_P is implied.
+// With PTE_PS 1 GiB and 2 MiB pages are used wherever va and pa are
+// both aligned. Page tables are walked once per table and filled in a
+// loop. The TLB is not flushed, so existing mappings should not be
+// changed on a live table. Returns 0, or -1 when out of memory or a
+// large page is in the way.
+int map_range(pagetable_t pt, uint64_t va, uint64_t pa, uint64_t len, uint64_t flags) {
+    struct walk_cache wc = { .root = pt };
+    uint64_t end = PGROUNDUP(va + len);
+    bool large = flags & PTE_PS;
+
+    flags = (flags & ~PTE_PS) | PTE_P;
+    va = PGROUNDDOWN(va);
+    pa = PGROUNDDOWN(pa);
+
+    while (va < end) {
+        uint64_t left = end - va;
+
+        if (large && has_gbpages() && ((va | pa) & (HUGE_PGSIZE - 1)) == 0 && left >= HUGE_PGSIZE &&
+            map_large(&wc, va, pa, PDPT_LEVEL, flags)) {
+            va += HUGE_PGSIZE;
+            pa += HUGE_PGSIZE;
+            continue;
+        }
+        if (large && ((va | pa) & (LARGE_PGSIZE - 1)) == 0 && left >= LARGE_PGSIZE &&
+            map_large(&wc, va, pa, PD_LEVEL, flags)) {
+            va += LARGE_PGSIZE;
+            pa += LARGE_PGSIZE;
+            continue;
+        }
+
+        int found;
+        page_entry_raw *pte = cached_walk(&wc, va, PT_LEVEL, 1, &found);
+        if (pte == 0)
+            return -1;
+
+        // Fill up to the end of this page table
+        uint64_t n = ENTRIES_COUNT - PX(PT_LEVEL, va);
+        if (n > left / PGSIZE)
+            n = left / PGSIZE;
+        for (uint64_t i = 0; i < n; i++)
+            pte[i] = make_pte(pa + i * PGSIZE, flags);
+        va += n * PGSIZE;
+        pa += n * PGSIZE;
+    }
 
-    // printf("ENTRY IN TABLE %p\n", tbl);
-    return tbl + ((va >> 12) & 0x1FF);
+    return 0;
 }
 
+// Replace the 2 MiB page mapped by pde with a page table of 512
+// small entries with the same flags. The old entry is left in the TLB,
+// the caller flushes it. Returns 0, or -1 when out of memory.
+int split_large(page_entry_raw *pde) {
+    pagetable_t pt = alloc_table();
+    if (pt == 0)
+        return -1;
+
+    uint64_t pa = pte_addr(*pde);
+    uint64_t flags = pte_flags(*pde) & ~PTE_PS;
+    for (int i = 0; i < ENTRIES_COUNT; i++)
+        pt[i] = make_pte(pa + i * PGSIZE, flags);
+    *pde = make_pte(VIRT_TO_PHYS(pt), PTE_P | PTE_W | (flags & PTE_U));
+    return 0;
+}
+
+// A large mapping holds one reference to its block, or one to each of
+// its pages once the block has been split by kalloc_split
+static void gather_block(struct mmu_gather *tlb, void *va, uint32_t order) {
+    if (va2page(va)->order == order) {
+        tlb_gather_page(tlb, va);
+        return;
+    }
+    for (uint64_t i = 0; i < (1UL << order); i++)
+        tlb_gather_page(tlb, (char *) va + i * PGSIZE);
+}
+
+// Remove the mappings of tlb->pt in [va, va + len), dropping a
+// reference to the pages (or swap slots) they point to if do_free is
+// set. Large pages must be covered whole. The flush and the frees are
+// left to tlb_gather_finish.
+void unmap_range(struct mmu_gather *tlb, uint64_t va, uint64_t len, bool do_free) {
+    struct walk_cache wc = { .root = tlb->pt };
+    uint64_t end = PGROUNDUP(va + len);
+
+    va = PGROUNDDOWN(va);
+    while (va < end) {
+        int level;
+        page_entry_raw *entry = cached_walk(&wc, va, PT_LEVEL, 0, &level);
+        uint64_t size = 1UL << PX_SHIFT(level);
+
+        if (entry == 0) {
+            // Nothing mapped under the missing entry
+            va = (va + size) & ~(size - 1);
+            continue;
+        }
+
+        if (level > PT_LEVEL) {
+            if ((va & (size - 1)) || end - va < size)
+                panic("unmap_range: partial large page");
+            // A 1 GiB page is beyond the allocator, so it cannot hold
+            // a reference to drop
+            if (do_free && level * 9 > KALLOC_MAX_ORDER)
+                panic("unmap_range: freeing a page the allocator does not own");
+            page_entry_raw pte = *entry;
+            *entry = 0;
+            tlb_gather_range(tlb, va, size);
+            if (do_free)
+                gather_block(tlb, PHYS_TO_VIRT(pte_addr(pte)), level * 9);
+            va += size;
+            continue;
+        }
+
+        uint64_t n = ENTRIES_COUNT - PX(PT_LEVEL, va);
+        if (n > (end - va) / PGSIZE)
+            n = (end - va) / PGSIZE;
+        for (uint64_t i = 0; i < n; i++, va += PGSIZE) {
+            page_entry_raw pte = entry[i];
+            if (pte_swapped(pte)) {
+                entry[i] = 0;
+                if (do_free)
+                    swap_free(pte_swap_slot(pte));
+                continue;
+            }
+            if (!pte_present(pte))
+                continue;
+            entry[i] = 0;
+            tlb_gather_range(tlb, va, PGSIZE);
+            if (do_free)
+                tlb_gather_page(tlb, PHYS_TO_VIRT(pte_addr(pte)));
+        }
+    }
+}
+
+static void free_tables(pagetable_t tbl, int level) {
+    for (int i = 0; i < ENTRIES_COUNT; i++) {
+        if (level > PT_LEVEL && pte_present(tbl[i]) && !pte_large(tbl[i]))
+            free_tables(pte_table(tbl[i]), level - 1);
+    }
+    kfree(tbl);
+}
+
+// Free a page table tree built by map_range. Leaf pages are left
+// alone, unmap them with unmap_range first.
+void free_pagetable(pagetable_t pt) {
+    free_tables(pt, 3);
+}
+
+// Extend the direct map at PHYS_BASE over RAM and ACPI tables in
+// [start, end) following the bootloader memory map; holes and device
+// ranges stay unmapped. Large pages keep it down to a few PDPTEs.
+// The boot identity map is dropped afterwards, leaving the lower half
+// to processes.
 pagetable_t kvminit(uint64_t start, uint64_t end) {
-    pagetable_t tbl4 = rcr3();
-    
-    char *addr;
-    addr = (char*)PGROUNDUP(start);
-    for(;addr + PGSIZE < end; addr += PGSIZE) {
-        //printf("Walking address %p\n", addr);
-        page_entry_raw *entry_raw = walk(tbl4, addr, 1);
-        // printf("FOUND ENTRY AT ADDRESS: %p\n", entry_raw);
-        while (entry_raw == 0) {}
-        init_entry(entry_raw, addr);
-        // printf("INITIALIZED ENTRY: %p\n", addr);
+    pagetable_t tbl4 = PHYS_TO_VIRT(rcr3() & PTE_ADDR_MASK);
+
+    for (int i = 0; i < nr_phys_regions; i++) {
+        struct phys_region *r = &phys_regions[i];
+        if (r->type != PHYS_USABLE && r->type != PHYS_ACPI_RECLAIMABLE && r->type != PHYS_ACPI_NVS)
+            continue;
+
+        uint64_t from = r->base > start ? r->base : start;
+        uint64_t to = r->base + r->length < end ? r->base + r->length : end;
+        if (from < to && map_range(tbl4, (uint64_t) PHYS_TO_VIRT(from), from, to - from, PTE_W | PTE_G | PTE_PS) < 0)
+            panic("kvminit");
     }
 
+    // Only the jump to the higher half ran from the identity map
+    tbl4[0] = 0;
+    wcr3(rcr3());
+
+    kernel_pagetable = tbl4;
     return tbl4;
 }
 
+// Tag TLB entries with a PCID so that switching address spaces does
+// not flush them (CPUID.01H:ECX.PCID)
+void pcid_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid_count(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!((ecx >> 17) & 1))
+        return;
+
+    // CR3 must hold PCID 0 while PCIDE is being set
+    wcr3(VIRT_TO_PHYS(kernel_pagetable));
+    wcr4(rcr4() | CR4_PCIDE);
+    pcid_enabled = 1;
+}
+
+// PAT entry values
+#define PAT_UC 0x00
+#define PAT_WC 0x01
+#define PAT_WT 0x04
+#define PAT_WB 0x06
+
+// Program IA32_PAT so the PTE_WB/WT/WC/UC flags mean what they say
+// (CPUID.01H:EDX.PAT). Entries 4-7 repeat 0-3. Must run on every CPU.
+void pat_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid_count(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!((edx >> 16) & 1))
+        return;
+
+    uint64_t pat = PAT_WB | PAT_WT << 8 | PAT_WC << 16 | PAT_UC << 24;
+    pat |= pat << 32;
+
+    // No line or TLB entry may be left from the old types
+    wbinvd();
+    wrmsr(MSR_IA32_PAT, pat);
+    wbinvd();
+    wcr3(rcr3());
+}
+
+// A new address space: a private top-level table whose present slots
+// point to the same lower tables as the kernel's, so kernel mappings
+// made there later are seen by everyone.
+pagetable_t new_pagetable(void) {
+    pagetable_t pt = alloc_table();
+    if (pt == 0)
+        return 0;
+
+    for (int i = 0; i < ENTRIES_COUNT; i++)
+        pt[i] = kernel_pagetable[i];
+    return pt;
+}
+
+// Free the tables of an address space made by new_pagetable, leaving
+// the shared kernel part alone. Pages must be unmapped first.
+void destroy_pagetable(pagetable_t pt) {
+    for (int i = 0; i < ENTRIES_COUNT; i++) {
+        if (pte_present(pt[i]) && pt[i] != kernel_pagetable[i])
+            free_tables(pte_table(pt[i]), PDPT_LEVEL);
+    }
+    kfree(pt);
+}
+
+static int copy_tables_cow(pagetable_t src, pagetable_t dst, int level) {
+    for (int i = 0; i < ENTRIES_COUNT; i++) {
+        page_entry_raw entry = src[i];
+        if (level == PT_LEVEL && pte_swapped(entry)) {
+            swap_dup(pte_swap_slot(entry));
+            dst[i] = entry;
+            continue;
+        }
+        if (!pte_present(entry))
+            continue;
+
+        if (level == PT_LEVEL || pte_large(entry)) {
+            if (entry & PTE_W) {
+                entry = (entry & ~PTE_W) | PTE_COW;
+                src[i] = entry;
+            }
+            if (level == PT_LEVEL)
+                page_get(PHYS_TO_VIRT(pte_addr(entry)));
+            else
+                page_get_block(PHYS_TO_VIRT(pte_addr(entry)), level * 9);
+            dst[i] = entry;
+            continue;
+        }
+
+        pagetable_t tbl = alloc_table();
+        if (tbl == 0)
+            return -1;
+        dst[i] = make_pte(VIRT_TO_PHYS(tbl), pte_flags(entry));
+        if (copy_tables_cow(pte_table(entry), tbl, level - 1) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Copy the private part of address space src into dst. Pages are not
+// copied: both sides map them read-only with PTE_COW and the page is
+// referenced once more; swapped out entries share their slot the same
+// way. The caller flushes src's stale writable entries. On failure dst
+// holds a partial copy to be unmapped.
+int copy_pagetable_cow(pagetable_t src, pagetable_t dst) {
+    for (int i = 0; i < ENTRIES_COUNT; i++) {
+        if (!pte_present(src[i]) || src[i] == kernel_pagetable[i])
+            continue;
+
+        pagetable_t tbl = alloc_table();
+        if (tbl == 0)
+            return -1;
+        dst[i] = make_pte(VIRT_TO_PHYS(tbl), pte_flags(src[i]));
+        if (copy_tables_cow(pte_table(src[i]), tbl, PDPT_LEVEL) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Switch to pt. With PCIDs the old entries of pcid are kept unless
+// flush is set, otherwise every CR3 load flushes the TLB.
+void load_pagetable(pagetable_t pt, uint16_t pcid, bool flush) {
+    uint64_t cr3 = VIRT_TO_PHYS(pt);
+
+    if (pcid_enabled) {
+        cr3 |= pcid & (NPCID - 1);
+        if (!flush)
+            cr3 |= CR3_NOFLUSH;
+    }
+    wcr3(cr3);
+}
+
 // Legacy hack
 // pagetable_t kvminit(uint64_t start, uint64_t end){
 
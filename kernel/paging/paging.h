@@ -10,9 +10,50 @@
 #include "stdbool.h"
 //#include "../lib/include/stdint.h"
 #include <inttypes.h>
+#include "../memlayout.h"
 
 #define ENTRIES_COUNT 512
 
+// Levels for walk_level, named by the table the entry lives in
+#define PT_LEVEL 0   // 4 KiB pages
+#define PD_LEVEL 1   // 2 MiB pages
+#define PDPT_LEVEL 2 // 1 GiB pages
+
+// Index of va in the table at the given level
+#define PX_SHIFT(level) (12 + (level) * 9)
+#define PX(level, va) (((uint64_t) (va) >> PX_SHIFT(level)) & 0x1FF)
+
+// Entry bits, see struct page_entry for their meaning
+#define PTE_P   (1UL << 0)
+#define PTE_W   (1UL << 1)
+#define PTE_U   (1UL << 2)
+#define PTE_PWT (1UL << 3)
+#define PTE_PCD (1UL << 4)
+#define PTE_A   (1UL << 5)
+#define PTE_D   (1UL << 6)
+#define PTE_PS  (1UL << 7)
+#define PTE_G   (1UL << 8)
+#define PTE_COW (1UL << 9)  // software bit: read-only because shared copy-on-write
+#define PTE_SWAP (1UL << 10) // software bit of a non-present entry: the page is in the swap slot in the address bits
+#define PTE_XD  (1UL << 63)
+
+#define PTE_ADDR_MASK 0x000FFFFFFFFFF000UL
+
+// Memory types. PCD and PWT select one of PAT entries 0-3, which
+// pat_init programs as below; the PAT bit is never set. Without PAT
+// support WC degrades to UC-, which is still safe for devices.
+#define PTE_WB 0
+#define PTE_WT PTE_PWT
+#define PTE_WC PTE_PCD
+#define PTE_UC (PTE_PCD | PTE_PWT)
+#define PTE_CACHE_MASK (PTE_PCD | PTE_PWT)
+
+#define MSR_IA32_PAT 0x277
+
+#define NPCID 4096               // 12-bit process-context identifiers
+#define CR3_NOFLUSH (1UL << 63)  // keep the PCID's TLB entries on a CR3 load
+#define CR4_PCIDE (1UL << 17)
+
 typedef uint64_t page_entry_raw;
 
 typedef page_entry_raw* pagetable_t;
@@ -39,8 +80,8 @@ struct page_entry {
     // Dirty; indicates whether software has written to the page referenced by this entry
     bool d;
 
-    // Indirectly determines the memory type used to access the page referenced by this entry
-    bool rsvd; // 1 if points to page, 0 if to the another table
+    // Page size; 1 if a PDPTE/PDE maps a 1 GiB/2 MiB page, 0 if it points to the next table
+    bool ps;
 
     uint8_t ign1; // 4 bits
 
@@ -53,6 +94,44 @@ struct page_entry {
     bool xd; // 😆😆😆
 };
 
+static inline page_entry_raw make_pte(uint64_t pa, uint64_t flags) {
+    return (pa & PTE_ADDR_MASK) | flags;
+}
+
+static inline uint64_t pte_addr(page_entry_raw pte) {
+    return pte & PTE_ADDR_MASK;
+}
+
+static inline uint64_t pte_flags(page_entry_raw pte) {
+    return pte & ~PTE_ADDR_MASK;
+}
+
+static inline bool pte_present(page_entry_raw pte) {
+    return pte & PTE_P;
+}
+
+static inline page_entry_raw make_swap_pte(uint64_t slot) {
+    return (slot << 12) | PTE_SWAP;
+}
+
+static inline bool pte_swapped(page_entry_raw pte) {
+    return !pte_present(pte) && (pte & PTE_SWAP);
+}
+
+static inline uint64_t pte_swap_slot(page_entry_raw pte) {
+    return pte_addr(pte) >> 12;
+}
+
+// Only meaningful in a PDE or PDPTE, bit 7 of a PTE is PAT
+static inline bool pte_large(page_entry_raw pte) {
+    return pte & PTE_PS;
+}
+
+// Next-level table, through the direct map
+static inline pagetable_t pte_table(page_entry_raw pte) {
+    return PHYS_TO_VIRT(pte_addr(pte));
+}
+
 struct page_entry_t {
     page_entry_raw table[ENTRIES_COUNT];
 };
@@ -67,6 +146,38 @@ void print_vm(pagetable_t);
 
 pagetable_t kvminit(uint64_t, uint64_t);
 
-struct page_entry_raw *walk(pagetable_t tbl, uint64_t va, bool alloc);
+page_entry_raw *walk(pagetable_t tbl, uint64_t va, bool alloc);
+
+page_entry_raw *walk_level(pagetable_t tbl, uint64_t va, int level, bool alloc);
+
+void init_entry(page_entry_raw *raw_entry, uint64_t addr);
+
+void init_large_entry(page_entry_raw *raw_entry, uint64_t addr);
+
+struct mmu_gather;
+
+int map_range(pagetable_t pt, uint64_t va, uint64_t pa, uint64_t len, uint64_t flags);
+
+void unmap_range(struct mmu_gather *tlb, uint64_t va, uint64_t len, bool do_free);
+
+void free_pagetable(pagetable_t pt);
+
+int split_large(page_entry_raw *pde);
+
+extern pagetable_t kernel_pagetable;
+
+extern bool pcid_enabled;
+
+void pcid_init(void);
+
+void pat_init(void);
+
+pagetable_t new_pagetable(void);
+
+void destroy_pagetable(pagetable_t pt);
+
+void load_pagetable(pagetable_t pt, uint16_t pcid, bool flush);
+
+int copy_pagetable_cow(pagetable_t src, pagetable_t dst);
 
 #endif
\ No newline at end of file
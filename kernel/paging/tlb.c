@@ -0,0 +1,195 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "tlb.h"
+#include "../sched/proc.h"
+#include "../apic/lapic.h"
+#include "../kalloc/kalloc.h"
+#include "../lib/include/x86_64.h"
+
+// TLB invalidation.
+//
+// Kernel mappings are global (PTE_G), so invlpg drops them under every
+// PCID and changing them means a flush on every online CPU.
+//
+// A process table is cached by the CPUs in its cpumask: those running
+// it and those that ran it and may still hold entries tagged with its
+// PCID. A flush clears the whole mask and interrupts only the CPUs
+// running the table; the others find their bit gone and flush the PCID
+// when they load it again (tlb_switch). A CPU publishes the table it
+// loads before it tests its bit, and a flush clears the bits before it
+// looks at what is loaded, so one of the two always sees the other.
+//
+// One shootdown is in flight at a time. CPUs waiting for it, or for a
+// spinlock, with interrupts off keep answering requests so that two
+// CPUs flushing at each other cannot deadlock.
+
+static pagetable_t volatile active[NCPU]; // table loaded on each CPU
+static bool pge_enabled;
+
+static volatile int shootdown_busy;
+static struct {
+    pagetable_t pt;
+    uint64_t *cpumask;
+    uint64_t start;
+    uint64_t end;
+    volatile uint64_t pending; // CPUs that have not flushed yet
+} shootdown;
+
+// Make kernel entries global (CPUID.01H:EDX.PGE). Run on every CPU.
+void tlb_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid_count(1, 0, &eax, &ebx, &ecx, &edx);
+    if ((edx >> 13) & 1) {
+        wcr4(rcr4() | CR4_PGE);
+        pge_enabled = 1;
+    }
+    active[cpuid()] = kernel_pagetable;
+}
+
+void tlb_flush_page(uint64_t va) {
+    invlpg(va);
+}
+
+// Drop every entry on this CPU, global ones and those of other PCIDs
+// included: toggling CR4.PGE does that in one go.
+void tlb_flush_all(void) {
+    if (pge_enabled) {
+        uint64_t cr4 = rcr4();
+        wcr4(cr4 & ~CR4_PGE);
+        wcr4(cr4);
+    } else {
+        wcr3(rcr3());
+    }
+}
+
+static void flush_local(pagetable_t pt, uint64_t start, uint64_t end) {
+    if ((end - start) / PGSIZE > TLB_FLUSH_CEILING) {
+        if (pt == kernel_pagetable)
+            tlb_flush_all();
+        else
+            wcr3(rcr3()); // the loaded PCID only
+        return;
+    }
+    for (uint64_t va = start; va < end; va += PGSIZE)
+        tlb_flush_page(va);
+}
+
+// Answer the shootdown in flight if it is for this CPU. Called from
+// the IPI and from spin loops, with interrupts off.
+void tlb_shootdown_handler(void) {
+    uint64_t bit = 1UL << cpuid();
+    if (!(shootdown.pending & bit))
+        return;
+
+    if (shootdown.pt == kernel_pagetable || active[cpuid()] == shootdown.pt) {
+        flush_local(shootdown.pt, shootdown.start, shootdown.end);
+        if (shootdown.pt != kernel_pagetable)
+            __sync_fetch_and_or(shootdown.cpumask, bit);
+    }
+    __sync_fetch_and_and(&shootdown.pending, ~bit);
+}
+
+static void shoot(pagetable_t pt, uint64_t *cpumask, uint64_t start, uint64_t end, uint64_t targets) {
+    while (__sync_lock_test_and_set(&shootdown_busy, 1))
+        tlb_shootdown_handler();
+
+    shootdown.pt = pt;
+    shootdown.cpumask = cpumask;
+    shootdown.start = start;
+    shootdown.end = end;
+    shootdown.pending = targets;
+    __sync_synchronize();
+
+    for (int cpu = 0; cpu < ncpu; cpu++) {
+        if (targets & (1UL << cpu))
+            lapic_send_ipi(cpu, IPI_TLB_SHOOTDOWN);
+    }
+    while (shootdown.pending)
+        asm volatile("pause");
+
+    __sync_lock_release(&shootdown_busy);
+}
+
+// Invalidate [start, end) of pt wherever it may be cached. For the
+// kernel table that is every CPU; for a process table, the CPUs in
+// *cpumask, or none if cpumask is 0 (a table that was never loaded).
+// Short ranges go page by page, longer ones flush the whole TLB.
+void tlb_flush_range(pagetable_t pt, uint64_t *cpumask, uint64_t start, uint64_t end) {
+    uint64_t targets = 0;
+
+    if (start >= end || (pt != kernel_pagetable && cpumask == 0))
+        return;
+
+    pushcli();
+    uint64_t self = 1UL << cpuid();
+    if (pt == kernel_pagetable) {
+        targets = (ncpu < 64 ? (1UL << ncpu) : 0) - 1;
+    } else {
+        uint64_t mask = __sync_fetch_and_and(cpumask, 0);
+        for (int cpu = 0; cpu < ncpu; cpu++) {
+            if ((mask & (1UL << cpu)) && active[cpu] == pt)
+                targets |= 1UL << cpu;
+        }
+    }
+
+    if (targets & self) {
+        flush_local(pt, start, end);
+        if (pt != kernel_pagetable)
+            __sync_fetch_and_or(cpumask, self);
+    }
+    if (targets & ~self)
+        shoot(pt, cpumask, start, end, targets & ~self);
+    popcli();
+}
+
+// Load pt on this CPU. Its PCID is flushed unless this CPU is still in
+// *cpumask, i.e. no flush of pt has passed it by since it last ran pt.
+void tlb_switch(pagetable_t pt, uint16_t pcid, uint64_t *cpumask) {
+    pushcli();
+    uint64_t bit = 1UL << cpuid();
+    active[cpuid()] = pt;
+    __sync_synchronize();
+    bool flush = pcid == 0 || !(__sync_fetch_and_or(cpumask, bit) & bit);
+    load_pagetable(pt, pcid, flush);
+    popcli();
+}
+
+void tlb_gather_init(struct mmu_gather *tlb, pagetable_t pt, uint64_t *cpumask) {
+    tlb->pt = pt;
+    tlb->cpumask = cpumask;
+    tlb->start = (uint64_t) -1;
+    tlb->end = 0;
+    tlb->nr = 0;
+}
+
+// Note that [va, va + size) was unmapped
+void tlb_gather_range(struct mmu_gather *tlb, uint64_t va, uint64_t size) {
+    if (va < tlb->start)
+        tlb->start = va;
+    if (va + size > tlb->end)
+        tlb->end = va + size;
+}
+
+static void gather_flush(struct mmu_gather *tlb) {
+    tlb_flush_range(tlb->pt, tlb->cpumask, tlb->start, tlb->end);
+    tlb->start = (uint64_t) -1;
+    tlb->end = 0;
+
+    for (int i = 0; i < tlb->nr; i++)
+        page_put(tlb->pages[i]);
+    tlb->nr = 0;
+}
+
+// Drop a reference to page once the gathered range is flushed
+void tlb_gather_page(struct mmu_gather *tlb, void *page) {
+    if (tlb->nr == MMU_GATHER_PAGES)
+        gather_flush(tlb);
+    tlb->pages[tlb->nr++] = page;
+}
+
+void tlb_gather_finish(struct mmu_gather *tlb) {
+    gather_flush(tlb);
+}
@@ -0,0 +1,49 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_TLB_H
+#define UNTITLED_OS_TLB_H
+
+#include <inttypes.h>
+#include "paging.h"
+
+#define TLB_FLUSH_CEILING 32 // pages; a longer range is flushed whole
+#define MMU_GATHER_PAGES 64  // freed pages held back until the flush
+
+#define CR4_PGE (1UL << 7)
+
+// Batches the TLB work of an unmap: the unmapped range is flushed once
+// at the end, and the pages are only freed after that, when no CPU
+// can reach them through a stale entry any more.
+struct mmu_gather {
+    pagetable_t pt;
+    uint64_t *cpumask; // CPUs that may cache pt, see tlb_flush_range
+    uint64_t start;    // range to flush, empty if start >= end
+    uint64_t end;
+    int nr;
+    void *pages[MMU_GATHER_PAGES];
+};
+
+void tlb_init(void);
+
+void tlb_flush_page(uint64_t va);
+
+void tlb_flush_all(void);
+
+void tlb_flush_range(pagetable_t pt, uint64_t *cpumask, uint64_t start, uint64_t end);
+
+void tlb_switch(pagetable_t pt, uint16_t pcid, uint64_t *cpumask);
+
+void tlb_shootdown_handler(void);
+
+void tlb_gather_init(struct mmu_gather *tlb, pagetable_t pt, uint64_t *cpumask);
+
+void tlb_gather_range(struct mmu_gather *tlb, uint64_t va, uint64_t size);
+
+void tlb_gather_page(struct mmu_gather *tlb, void *page);
+
+void tlb_gather_finish(struct mmu_gather *tlb);
+
+#endif //UNTITLED_OS_TLB_H
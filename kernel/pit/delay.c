@@ -0,0 +1,32 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "pit.h"
+#include "../lib/include/x86_64.h"
+
+#define PIT_HZ 1193182
+#define PIT_CH2_DATA 0x42
+#define PIT_COMMAND 0x43
+#define PIT_CH2_GATE 0x61 // bit 0 gates channel 2, bit 5 reads its output
+#define PIT_CH2_ONESHOT 0xB0 // channel 2, low then high byte, mode 0
+
+// Busy-wait us microseconds on PIT channel 2, the speaker timer, which
+// nothing else uses. Channel 0 keeps driving the scheduler tick.
+void pit_delay(uint32_t us) {
+    while (us > 0) {
+        uint32_t chunk = us < 50000 ? us : 50000; // the counter has 16 bits
+        uint16_t count = (uint64_t) chunk * PIT_HZ / 1000000;
+        uint8_t gate = inb(PIT_CH2_GATE) & ~0x3; // speaker off, gate low
+
+        outb(PIT_CH2_GATE, gate);
+        outb(PIT_COMMAND, PIT_CH2_ONESHOT);
+        outb(PIT_CH2_DATA, count & 0xFF);
+        outb(PIT_CH2_DATA, count >> 8);
+        outb(PIT_CH2_GATE, gate | 1);
+        while (!(inb(PIT_CH2_GATE) & 0x20))
+            ;
+        us -= chunk;
+    }
+}
@@ -1,9 +1,13 @@
 #ifndef PIT_H
 #define PIT_H
 
+#include <inttypes.h>
+
 extern void init_pit();
 
 extern void send_values_to_sched();
 
 extern void stop_timer();
+
+void pit_delay(uint32_t us);
 #endif // PIT_H
\ No newline at end of file
@@ -0,0 +1,18 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "percpu.h"
+#include "proc.h"
+#include "../lib/include/x86_64.h"
+
+// Point GS at cpus[cpu]. First thing on every CPU, before anything
+// takes a spinlock or asks for cpuid().
+void percpu_init(int cpu) {
+    struct cpu *c = &cpus[cpu];
+
+    c->self = c;
+    c->id = cpu;
+    wrmsr(MSR_GS_BASE, (uint64_t) c);
+}
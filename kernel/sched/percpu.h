@@ -0,0 +1,40 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_PERCPU_H
+#define UNTITLED_OS_PERCPU_H
+
+#include <stddef.h>
+
+#define MSR_GS_BASE 0xC0000101
+
+// Each CPU's GS base points at its own struct cpu, so a field of the
+// running CPU is one gs-relative instruction away. The access is a
+// single instruction, so an interrupt or a move to another CPU cannot
+// split it; callers that need the same CPU across several accesses
+// still disable interrupts.
+#define percpu_offset(field) offsetof(struct cpu, field)
+#define percpu_type(field) __typeof__(((struct cpu *) 0)->field)
+
+#define this_cpu_read(field) ({                                              \
+    percpu_type(field) __val;                                                \
+    asm volatile("mov %%gs:%c1, %0" : "=r" (__val) : "i" (percpu_offset(field))); \
+    __val;                                                                   \
+})
+
+#define this_cpu_write(field, val)                                           \
+    asm volatile("mov %1, %%gs:%c0" : : "i" (percpu_offset(field)),          \
+                 "r" ((percpu_type(field)) (val)) : "memory")
+
+#define this_cpu_add(field, val)                                             \
+    asm volatile("add %1, %%gs:%c0" : : "i" (percpu_offset(field)),          \
+                 "r" ((percpu_type(field)) (val)) : "memory", "cc")
+
+#define this_cpu_inc(field) this_cpu_add(field, 1)
+#define this_cpu_dec(field) this_cpu_add(field, -1)
+
+void percpu_init(int cpu);
+
+#endif //UNTITLED_OS_PERCPU_H
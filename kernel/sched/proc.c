@@ -7,11 +7,26 @@
 #include "proc.h"
 #include "../lib/include/panic.h"
 #include "sched_states.h"
+#include "../vm/vm.h"
+#include "../kalloc/slab.h"
+#include "../paging/tlb.h"
+#include "../vm/reclaim.h"
 
-struct cpu current_cpu;
+struct cpu cpus[NCPU];
+int ncpu = 1;
 struct spinlock pid_lock;
 struct spinlock proc_lock;
 struct proc_node *proc_list;
+static struct kmem_cache *proc_cache;
+static struct kmem_cache *proc_node_cache;
+static struct spinlock pcid_lock;
+static uint64_t pcid_map[NPCID / 64];
+
+// The running thread, 0 in a CPU's idle loop. One read, so it needs
+// no pushcli: whichever CPU it runs on is running this thread.
+struct thread *mythread(void) {
+    return this_cpu_read(current_thread);
+}
 
 pid_t generate_pid() {
     acquire_spinlock(&pid_lock);
@@ -22,30 +37,122 @@ pid_t generate_pid() {
     return local_pid;
 }
 
+// PCID 0 belongs to the kernel table and is handed out again when all
+// others are taken; such processes flush the TLB on every switch.
+static uint16_t alloc_pcid(void) {
+    uint16_t pcid = 0;
+
+    acquire_spinlock(&pcid_lock);
+    for (int i = 1; i < NPCID; i++) {
+        if (!(pcid_map[i / 64] & (1UL << (i % 64)))) {
+            pcid_map[i / 64] |= 1UL << (i % 64);
+            pcid = i;
+            break;
+        }
+    }
+    release_spinlock(&pcid_lock);
+    return pcid;
+}
+
+static void free_pcid(uint16_t pcid) {
+    acquire_spinlock(&pcid_lock);
+    pcid_map[pcid / 64] &= ~(1UL << (pcid % 64));
+    release_spinlock(&pcid_lock);
+}
+
+// Returns a new process without threads, or 0 if memory is short
+// even after reclaim.
 struct proc *allocproc(void) {
-    struct proc *proc = kalloc();
+    struct proc *proc = kmem_cache_alloc(proc_cache);
+    if (proc == 0 && reclaim_pages(RECLAIM_BATCH) > 0)
+        proc = kmem_cache_alloc(proc_cache);
+    if (proc == 0)
+        return 0;
 
-    if (proc == 0) {
-        panic("Failed to alloc proc\n");
+    proc->pagetable = new_pagetable();
+    if (proc->pagetable == 0 && reclaim_pages(RECLAIM_BATCH) > 0)
+        proc->pagetable = new_pagetable();
+    if (proc->pagetable == 0) {
+        kmem_cache_free(proc_cache, proc);
+        return 0;
     }
 
     pid_t pid = generate_pid();
-    
+
+    proc->pid = pid;
     proc->threads = 0;
     proc->killed = 0;
+    proc->pcid = alloc_pcid();
+    proc->cpumask = 0;
+    proc->brk = UVM_BASE;
+    sched_init_proc(proc);
 
+    return proc;
+}
+
+// Make proc visible to the scheduler once it has its threads
+void enqueue_proc(struct proc *proc) {
     acquire_spinlock(&proc_lock);
     push_proc_list(&proc_list, proc);
     release_spinlock(&proc_lock);
+}
 
-    return proc;
+// Look a process up by pid. Called with proc_lock held.
+struct proc *find_proc(pid_t pid) {
+    struct proc_node *node = proc_list;
+    if (node == 0)
+        return 0;
+    do {
+        if (node->data->pid == pid)
+            return node->data;
+        node = node->next;
+    } while (node != proc_list);
+    return 0;
+}
+
+// The process of the running thread, 0 before the scheduler starts
+struct proc *myproc(void) {
+    struct thread *thread = mythread();
+    return thread ? thread->proc : 0;
+}
+
+// Release a proc that is off the proc list and loaded on no CPU.
+// Its threads and user pages must be gone already.
+void freeproc(struct proc *proc) {
+    uvm_free(proc);
+    destroy_pagetable(proc->pagetable);
+    if (proc->pcid != 0)
+        free_pcid(proc->pcid);
+    kmem_cache_free(proc_cache, proc);
+}
+
+void add_thread(struct proc *proc, struct thread *thread) {
+    thread->proc = proc;
+    push_thread_list(&proc->threads, thread);
+}
+
+// Load proc's address space on this CPU. A CPU that has not run proc
+// yet flushes its PCID, which may still tag a dead process's entries.
+void switchuvm(struct proc *proc) {
+    pushcli();
+    if (this_cpu_read(proc) != proc) {
+        tlb_switch(proc->pagetable, proc->pcid, &proc->cpumask);
+        this_cpu_write(proc, proc);
+    }
+    popcli();
 }
 
 struct proc_node *procinit(void) {
     init_spinlock(&pid_lock, "pid_lock");
     init_spinlock(&proc_lock, "proc_lock");
-    
+    init_spinlock(&pcid_lock, "pcid_lock");
+    proc_cache = kmem_cache_create("proc", sizeof(struct proc), CACHE_LINE_SIZE, 0);
+    proc_node_cache = kmem_cache_create("proc_node", sizeof(struct proc_node), 0, 0);
+    threadinit();
+
     struct proc *init_proc = allocproc();
+    if (init_proc == 0)
+        panic("procinit: no memory for init");
     printf("Init proc allocated\n");
 
     static uint32_t arg_value1 = 1;
@@ -60,18 +167,19 @@ struct proc_node *procinit(void) {
     struct thread *new_thread1 = create_thread(thread_function, 1, &arg1);
     struct thread *new_thread2 = create_thread(thread_function, 1, &arg2);
     printf("thread initialized\n");
+    add_thread(init_proc, new_thread1);
+    add_thread(init_proc, new_thread2);
+    printf("thread pushed into list\n");
     change_thread_state(new_thread1, RUNNABLE);
     change_thread_state(new_thread2, RUNNABLE);
     printf("thread state initialized\n");
-    push_thread_list(&(init_proc->threads), new_thread1);
-    push_thread_list(&(init_proc->threads), new_thread2);
-    printf("thread pushed into list\n");
+    enqueue_proc(init_proc);
 
     return proc_list;
 }
 
 void push_proc_list(struct proc_node **list, struct proc *proc) {
-    struct proc_node *new_node = kalloc();
+    struct proc_node *new_node = kmem_cache_alloc(proc_node_cache);
     new_node->data = proc;
     if ((*list) != 0) {
         new_node->next = (*list);
@@ -91,12 +199,12 @@ struct proc *pop_proc_list(struct proc_node **list) {
     } else {
         struct proc* p = (*list)->data;
         if ((*list)->next = (*list)) {
-            kfree(*list);
+            kmem_cache_free(proc_node_cache, *list);
             *list = 0;
         } else {
             (*list)->prev->next = (*list)->next;
             (*list)->next->prev = (*list)->prev;
-            kfree(*list);
+            kmem_cache_free(proc_node_cache, *list);
         }
         return p;
     }
@@ -118,3 +226,36 @@ struct proc *peek_proc_list(struct proc_node *list) {
     }
 }
 
+// Start a child process that shares the caller's memory copy-on-write,
+// so only page tables are copied. Without a user mode there is no trap
+// frame to return through twice; the child instead runs one thread at
+// start_function. Returns the child's pid or -1.
+pid_t fork(void (*start_function)(void *), int argc, struct argument *args) {
+    struct proc *parent = myproc();
+    if (parent == 0)
+        return -1;
+
+    struct proc *child = allocproc();
+    if (child == 0)
+        return -1;
+    if (uvm_copy(parent, child) < 0) {
+        freeproc(child);
+        return -1;
+    }
+
+    struct thread *thread = create_thread(start_function, argc, args);
+    add_thread(child, thread);
+    enqueue_proc(child);
+    change_thread_state(thread, RUNNABLE);
+
+    return child->pid;
+}
+
+// Grow or shrink the caller's heap by n bytes, returning the old end
+char *sbrk(int n) {
+    struct proc *proc = myproc();
+    if (proc == 0)
+        return (char *) -1;
+
+    return (char *) uvm_sbrk(proc, n);
+}
@@ -7,14 +7,17 @@
 #ifndef UNTITLED_OS_PROC_H
 #define UNTITLED_OS_PROC_H
 #define MAXPROCS 100
+#define NCPU 8 // maximum number of CPUs
 //#include "../lib/include/stdint.h"
 #include <inttypes.h>
 #include <stddef.h>
 #include "../tty/tty.h"
 #include "../sync/spinlock.h"
 #include "../../kernel/kalloc/kalloc.h"
+#include "../paging/paging.h"
 #include "threads.h"
 #include "sched_states.h"
+#include "percpu.h"
 
 typedef size_t pid_t;
 
@@ -22,13 +25,29 @@ struct proc {
     pid_t pid;
     int killed;
     struct thread_node *threads;
+    pagetable_t pagetable;           // own top-level table, kernel half shared
+    uint16_t pcid;                   // TLB tag, 0 if none was free
+    uint64_t cpumask;                // CPUs that may cache this address space, see paging/tlb.c
+    uint64_t brk;                    // end of the heap, which starts at UVM_BASE
+    uint32_t weight;                 // CPU share against other processes
+    struct proc_sched sched[NCPU];   // group entity and runnable threads, per CPU
 };
 
+// Reached through GS on the CPU itself, see percpu.h. A cache line
+// each, so CPUs updating their own counters do not share lines.
 struct cpu {
+    struct cpu *self;                // for mycpu(), the GS base as a pointer
+    int id;                          // index in cpus
     int ncli;                        // Depth of pushcli nesting.
     int intena;                      // Were interrupts enabled before pushcli?
     struct thread *current_thread;   // The thread running on this cpu or null
-};
+    struct proc *proc;               // Address space loaded on this cpu or null
+    struct context *scheduler;       // Saved idle loop while a thread runs
+    struct thread *prev_thread;      // Switched away from, see finish_switch
+    uint64_t nr_switches;            // context switches on this cpu
+    uint64_t nr_migrations;          // threads this cpu moved between run queues
+    void *volatile stack_reserve[STACK_RESERVE_PAGES]; // 0 for a slot taken by a fault
+} __attribute__((aligned(CACHE_LINE_SIZE)));
 
 struct proc_node {
     struct proc *data;
@@ -36,9 +55,25 @@ struct proc_node {
     struct proc_node *prev;
 };
 
-extern struct cpu current_cpu;
+extern struct cpu cpus[NCPU];
+#define current_cpu (*mycpu())
+extern int ncpu; // CPUs online
+extern struct spinlock proc_lock; // guards proc_list
 extern struct proc_node *proc_list;
 
+// Index of the running CPU; callers must have interrupts disabled
+// unless any answer will do
+static inline int cpuid(void) {
+    return this_cpu_read(id);
+}
+
+// This CPU's struct cpu; callers must have interrupts disabled
+static inline struct cpu *mycpu(void) {
+    return this_cpu_read(self);
+}
+
+struct thread *mythread(void);
+
 void push_proc_list(struct proc_node **list, struct proc *proc);
 
 struct proc *pop_proc_list(struct proc_node **list);
@@ -49,6 +84,22 @@ struct proc *peek_proc_list(struct proc_node *list);
 
 struct proc_node *procinit(void);
 
+struct proc *allocproc(void);
+
+void enqueue_proc(struct proc *proc);
+
+struct proc *find_proc(pid_t pid);
+
+struct proc *myproc(void);
+
+pid_t fork(void (*start_function)(void *), int argc, struct argument *args);
+
+void freeproc(struct proc *proc);
+
+void add_thread(struct proc *proc, struct thread *thread);
+
+void switchuvm(struct proc *proc);
+
 int exec(char *file, char *argv[]);
 
 char *sbrk(int n);
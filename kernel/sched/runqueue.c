@@ -0,0 +1,461 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "runqueue.h"
+#include "threads.h"
+#include "proc.h"
+#include "../lib/include/x86_64.h"
+#include "../lib/include/panic.h"
+#include "../sync/spinlock.h"
+#include "../memlayout.h"
+#include "../apic/lapic.h"
+
+// Fair share in two levels: the processes with runnable threads
+// share the CPU by their weights, and each process's share is split
+// between its threads by their nice values. Running threads are kept
+// out of the trees and put back when they are preempted.
+//
+// Every CPU has its own queue, so picks on different CPUs do not
+// contend. A thread is on the queue of thread->cpu, and its state and
+// cpu are guarded by that queue's lock. Threads move between queues
+// when they wake up, when an idle CPU steals from the busiest one,
+// and every REBALANCE_TICKS picks when the loads drift apart.
+struct runqueue {
+    struct spinlock lock;
+    int cpu;
+    struct cfs_rq procs;         // group entities of struct proc
+    uint32_t nr_running;         // threads queued
+    struct thread *curr;         // running thread or null when idle
+    uint32_t ticks;              // picks, paces the periodic balance
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct runqueue runqueues[NCPU];
+
+// Weight of nice -20 .. 19, each step is about 10% of CPU time
+static const uint32_t nice_weights[NICE_MAX - NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906,
+    3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423,
+    335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45,
+    36, 29, 23, 18, 15,
+};
+
+void rq_init(void) {
+    for (int i = 0; i < NCPU; i++) {
+        init_spinlock(&runqueues[i].lock, "runqueue");
+        runqueues[i].cpu = i;
+    }
+}
+
+void sched_init_thread(struct thread *thread) {
+    thread->nice = 0;
+    thread->se.vruntime = 0;
+    thread->se.weight = NICE_0_WEIGHT;
+    thread->se.on_rq = 0;
+    thread->se.exec_start = 0;
+    thread->cpu = 0;
+    thread->affinity = ~0UL;
+    thread->wake_pending = 0;
+}
+
+void sched_init_proc(struct proc *proc) {
+    proc->weight = NICE_0_WEIGHT;
+    for (int i = 0; i < NCPU; i++) {
+        struct proc_sched *ps = &proc->sched[i];
+        ps->se.vruntime = 0;
+        ps->se.weight = NICE_0_WEIGHT;
+        ps->se.on_rq = 0;
+        ps->cfs.tree.node = 0;
+        ps->cfs.leftmost = 0;
+        ps->cfs.min_vruntime = 0;
+        ps->cfs.nr_running = 0;
+    }
+}
+
+static uint64_t online_mask(void) {
+    return (1UL << ncpu) - 1;
+}
+
+// Threads queued plus the one running, read without the lock when
+// only a hint is needed
+static uint32_t rq_load(struct runqueue *rq) {
+    return rq->nr_running + (rq->curr != 0);
+}
+
+// Queue locks are taken in CPU order so two CPUs locking the same
+// pair cannot deadlock
+static void double_lock(struct runqueue *a, struct runqueue *b) {
+    if (a == b) {
+        acquire_spinlock(&a->lock);
+    } else if (a->cpu < b->cpu) {
+        acquire_spinlock(&a->lock);
+        acquire_spinlock(&b->lock);
+    } else {
+        acquire_spinlock(&b->lock);
+        acquire_spinlock(&a->lock);
+    }
+}
+
+static void double_unlock(struct runqueue *a, struct runqueue *b) {
+    if (a != b)
+        release_spinlock(&b->lock);
+    release_spinlock(&a->lock);
+}
+
+// The tree functions are called with the queue's lock held
+static void enqueue_entity(struct cfs_rq *cfs, struct sched_entity *se) {
+    struct rb_node **link = &cfs->tree.node;
+    struct rb_node *parent = 0;
+    int leftmost = 1;
+
+    // Equal keys go right, so entities with the same vruntime take turns
+    while (*link) {
+        parent = *link;
+        if (se->vruntime < rb_entry(parent, struct sched_entity, node)->vruntime) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = 0;
+        }
+    }
+    rb_link_node(&se->node, parent, link);
+    rb_insert_color(&se->node, &cfs->tree);
+    if (leftmost)
+        cfs->leftmost = &se->node;
+    se->on_rq = 1;
+    cfs->nr_running++;
+}
+
+static void dequeue_entity(struct cfs_rq *cfs, struct sched_entity *se) {
+    if (cfs->leftmost == &se->node)
+        cfs->leftmost = rb_next(&se->node);
+    rb_erase(&se->node, &cfs->tree);
+    se->on_rq = 0;
+    cfs->nr_running--;
+}
+
+static struct sched_entity *first_entity(struct cfs_rq *cfs) {
+    return cfs->leftmost ? rb_entry(cfs->leftmost, struct sched_entity, node) : 0;
+}
+
+static void update_min_vruntime(struct cfs_rq *cfs) {
+    struct sched_entity *first = first_entity(cfs);
+    if (first != 0 && first->vruntime > cfs->min_vruntime)
+        cfs->min_vruntime = first->vruntime;
+}
+
+// Where an entity joining the queue starts: a new one at the minimum,
+// one that slept at most SCHED_WAKEUP_CREDIT before it
+static void place_entity(struct cfs_rq *cfs, struct sched_entity *se, int woken) {
+    uint64_t start = cfs->min_vruntime;
+    if (woken)
+        start = start > SCHED_WAKEUP_CREDIT ? start - SCHED_WAKEUP_CREDIT : 0;
+    if (se->vruntime < start)
+        se->vruntime = start;
+}
+
+static void enqueue_thread(struct runqueue *rq, struct thread *thread, int woken) {
+    struct proc_sched *ps = &thread->proc->sched[rq->cpu];
+
+    if (ps->cfs.nr_running == 0) {
+        place_entity(&rq->procs, &ps->se, 1);
+        enqueue_entity(&rq->procs, &ps->se);
+    }
+    place_entity(&ps->cfs, &thread->se, woken);
+    enqueue_entity(&ps->cfs, &thread->se);
+    rq->nr_running++;
+}
+
+static void dequeue_thread(struct runqueue *rq, struct thread *thread) {
+    struct proc_sched *ps = &thread->proc->sched[rq->cpu];
+
+    dequeue_entity(&ps->cfs, &thread->se);
+    if (ps->cfs.nr_running == 0)
+        dequeue_entity(&rq->procs, &ps->se);
+    rq->nr_running--;
+}
+
+// Carry a thread's lead or lag over the minimum of its process's
+// queue on src to the queue on dst, the clocks of the two are unrelated
+static void renormalize(struct thread *thread, struct runqueue *src, struct runqueue *dst) {
+    struct proc *proc = thread->proc;
+    uint64_t src_min = proc->sched[src->cpu].cfs.min_vruntime;
+    uint64_t lag = thread->se.vruntime > src_min ? thread->se.vruntime - src_min : 0;
+
+    thread->se.vruntime = proc->sched[dst->cpu].cfs.min_vruntime + lag;
+    thread->cpu = dst->cpu;
+    this_cpu_inc(nr_migrations);
+}
+
+// Move a queued thread, both locks held
+static void migrate_thread(struct runqueue *src, struct runqueue *dst, struct thread *thread) {
+    dequeue_thread(src, thread);
+    renormalize(thread, src, dst);
+    enqueue_thread(dst, thread, 0);
+}
+
+// The allowed CPU with the least load, or the one the thread last ran
+// on while its caches are warm and it is not much busier
+static struct runqueue *select_rq(struct thread *thread, uint64_t allowed) {
+    struct runqueue *best = 0;
+
+    allowed &= online_mask();
+    if (allowed == 0)
+        allowed = online_mask();
+    for (int i = 0; i < ncpu; i++) {
+        if ((allowed >> i & 1) && (best == 0 || rq_load(&runqueues[i]) < rq_load(best)))
+            best = &runqueues[i];
+    }
+
+    struct runqueue *last = &runqueues[thread->cpu];
+    if (thread->state != NEW && (allowed >> thread->cpu & 1) &&
+        rq_load(last) <= rq_load(best) + WAKE_AFFINE_SLACK)
+        return last;
+    return best;
+}
+
+// The other CPU with the most threads waiting
+static struct runqueue *find_busiest(struct runqueue *rq) {
+    struct runqueue *busiest = 0;
+
+    for (int i = 0; i < ncpu; i++) {
+        struct runqueue *other = &runqueues[i];
+        if (other != rq && other->nr_running > 0 && (busiest == 0 || rq_load(other) > rq_load(busiest)))
+            busiest = other;
+    }
+    return busiest;
+}
+
+// Take up to nr threads queued on src that may run on rq. The ones
+// at the right of the trees would wait longest where they are.
+static uint32_t pull_threads(struct runqueue *rq, struct runqueue *src, uint32_t nr) {
+    uint32_t moved = 0;
+    struct rb_node *gnode = rb_last(&src->procs.tree);
+
+    while (gnode != 0 && moved < nr) {
+        struct proc_sched *ps = rb_entry(gnode, struct proc_sched, se.node);
+        gnode = rb_prev(gnode);
+
+        struct rb_node *tnode = rb_last(&ps->cfs.tree);
+        while (tnode != 0 && moved < nr) {
+            struct thread *thread = rb_entry(tnode, struct thread, se.node);
+            tnode = rb_prev(tnode);
+            if (thread->affinity >> rq->cpu & 1) {
+                migrate_thread(src, rq, thread);
+                moved++;
+            }
+        }
+    }
+    return moved;
+}
+
+static uint64_t scale(uint64_t delta, uint32_t weight) {
+    return delta * NICE_0_WEIGHT / weight;
+}
+
+// Charge the time since the last pick to the thread and its process
+static void account(struct runqueue *rq, struct thread *thread, uint64_t now) {
+    struct proc_sched *ps = &thread->proc->sched[rq->cpu];
+    uint64_t delta = now - thread->se.exec_start;
+
+    thread->se.vruntime += scale(delta, thread->se.weight);
+
+    // The process stays queued while its other threads wait
+    if (ps->se.on_rq) {
+        dequeue_entity(&rq->procs, &ps->se);
+        ps->se.vruntime += scale(delta, ps->se.weight);
+        enqueue_entity(&rq->procs, &ps->se);
+    } else {
+        ps->se.vruntime += scale(delta, ps->se.weight);
+    }
+}
+
+// Lock the queue the thread is on, and dst as well if given. Returns
+// with the thread's queue locked, which may have changed meanwhile.
+static struct runqueue *lock_thread_rq(struct thread *thread, struct runqueue *dst) {
+    while (1) {
+        struct runqueue *rq = &runqueues[thread->cpu];
+        double_lock(rq, dst ? dst : rq);
+        if (rq->cpu == thread->cpu)
+            return rq;
+        double_unlock(rq, dst ? dst : rq);
+    }
+}
+
+// An idle CPU is in hlt until its next tick, wake it for new work
+static void kick(struct runqueue *rq) {
+    if (rq->curr == 0 && rq->cpu != cpuid())
+        lapic_send_ipi(rq->cpu, IPI_RESCHEDULE);
+}
+
+static int is_wakeup(struct thread *thread, enum sched_states state) {
+    return thread->state != RUNNABLE && thread->state != ON_CPU && state == RUNNABLE;
+}
+
+// Move a thread between states, putting it on a run queue when it
+// becomes RUNNABLE and taking it off when it blocks or exits. A
+// waking thread goes to the CPU select_rq picks for it. A running
+// thread that stops is charged here, it may be queued again before
+// its CPU gets to rq_pick_next. A running thread woken before it got
+// to block stays running and its next WAIT returns at once.
+void rq_change_state(struct thread *thread, enum sched_states state) {
+    struct runqueue *rq, *dst;
+
+    while (1) {
+        dst = is_wakeup(thread, state) ? select_rq(thread, thread->affinity) : 0;
+        rq = lock_thread_rq(thread, dst);
+        if (is_wakeup(thread, state) == (dst != 0))
+            break;
+        double_unlock(rq, dst ? dst : rq); // someone got there first
+    }
+
+    if (thread->state == ON_CPU && state == RUNNABLE) {
+        thread->wake_pending = 1;
+        state = ON_CPU; // put back on the queue at its next pick
+    } else if (thread->state == ON_CPU && state == WAIT && thread->wake_pending) {
+        thread->wake_pending = 0;
+        state = ON_CPU;
+    } else if (thread->state == RUNNABLE && state != RUNNABLE) {
+        dequeue_thread(rq, thread);
+    } else if (thread->state == ON_CPU && state != ON_CPU) {
+        account(rq, thread, rdtsc());
+    } else if (dst != 0) {
+        if (dst != rq)
+            renormalize(thread, rq, dst);
+        enqueue_thread(dst, thread, thread->state != NEW);
+        kick(dst);
+    }
+    thread->state = state;
+    double_unlock(rq, dst ? dst : rq);
+}
+
+// Put prev back if it is still running here, then take the leftmost
+// thread of the leftmost process. An idle CPU steals from the busiest
+// one first, and every REBALANCE_TICKS picks the queue takes half the
+// difference to the busiest. Returns prev again if nothing else is
+// runnable here, 0 if nothing is at all.
+struct thread *rq_pick_next(struct thread *prev) {
+    struct runqueue *rq = &runqueues[cpuid()];
+    struct runqueue *other = 0;
+    struct thread *next = 0;
+    uint64_t now = rdtsc();
+    int stays = prev != 0 && prev->state == ON_CPU && prev->cpu == rq->cpu;
+    int balance = 0;
+
+    // The second queue is chosen without locks, what it is for is
+    // checked again under them
+    if (stays && !(prev->affinity >> rq->cpu & 1)) {
+        other = select_rq(prev, prev->affinity);
+    } else if (ncpu > 1 && ((!stays && rq->nr_running == 0) || ++rq->ticks % REBALANCE_TICKS == 0)) {
+        other = find_busiest(rq);
+        balance = other != 0;
+    }
+    if (other == 0)
+        other = rq;
+    double_lock(rq, other);
+
+    // prev may have blocked and been woken onto a queue since
+    rq->curr = 0;
+    if (prev != 0 && prev->state == ON_CPU && prev->cpu == rq->cpu) {
+        account(rq, prev, now);
+        prev->state = RUNNABLE;
+        if ((prev->affinity >> rq->cpu & 1) || other == rq || balance) {
+            enqueue_thread(rq, prev, 0);
+        } else {
+            // Its affinity no longer has this CPU
+            renormalize(prev, rq, other);
+            enqueue_thread(other, prev, 0);
+            kick(other);
+        }
+    }
+
+    if (balance) {
+        uint32_t load = rq_load(rq), busiest = rq_load(other);
+        if (rq->nr_running == 0 && other->nr_running > 0)
+            pull_threads(rq, other, 1);
+        else if (busiest >= load + 2)
+            pull_threads(rq, other, (busiest - load) / 2);
+    }
+    if (other != rq)
+        release_spinlock(&other->lock);
+
+    struct sched_entity *group = first_entity(&rq->procs);
+    if (group != 0) {
+        struct proc_sched *ps = rb_entry(group, struct proc_sched, se);
+        update_min_vruntime(&rq->procs);
+        update_min_vruntime(&ps->cfs);
+        next = rb_entry(first_entity(&ps->cfs), struct thread, se);
+        dequeue_thread(rq, next);
+        next->state = ON_CPU;
+    }
+    if (next != 0)
+        next->se.exec_start = now;
+    rq->curr = next;
+    release_spinlock(&rq->lock);
+
+    return next;
+}
+
+// Weights only change how fast vruntime grows from now on, so a
+// queued entity keeps its place in the tree
+void thread_set_nice(struct thread *thread, int nice) {
+    if (nice < NICE_MIN || nice > NICE_MAX)
+        panic("thread_set_nice");
+
+    struct runqueue *rq = lock_thread_rq(thread, 0);
+    thread->nice = nice;
+    thread->se.weight = nice_weights[nice - NICE_MIN];
+    release_spinlock(&rq->lock);
+}
+
+// The process's share against other processes, NICE_0_WEIGHT is the
+// default. It applies on every CPU the process has threads on.
+void proc_set_weight(struct proc *proc, uint32_t weight) {
+    if (weight == 0)
+        panic("proc_set_weight");
+
+    proc->weight = weight;
+    for (int i = 0; i < NCPU; i++) {
+        acquire_spinlock(&runqueues[i].lock);
+        proc->sched[i].se.weight = weight;
+        release_spinlock(&runqueues[i].lock);
+    }
+}
+
+// Restrict a thread to the CPUs in mask. A queued thread moves at
+// once, a running one when it is next preempted. Returns -1 if no CPU
+// in mask is online.
+int thread_set_affinity(struct thread *thread, uint64_t mask) {
+    if ((mask & online_mask()) == 0)
+        return -1;
+
+    struct runqueue *rq, *dst;
+    while (1) {
+        int cpu = thread->cpu;
+        dst = (mask >> cpu & 1) ? 0 : select_rq(thread, mask);
+        rq = lock_thread_rq(thread, dst);
+        if (rq->cpu == cpu)
+            break;
+        double_unlock(rq, dst ? dst : rq);
+    }
+
+    thread->affinity = mask;
+    if (dst != 0 && thread->state == RUNNABLE) {
+        migrate_thread(rq, dst, thread);
+        kick(dst);
+    }
+    double_unlock(rq, dst ? dst : rq);
+    return 0;
+}
+
+uint32_t rq_nr_running(void) {
+    uint32_t nr = 0;
+    for (int i = 0; i < NCPU; i++)
+        nr += runqueues[i].nr_running;
+    return nr;
+}
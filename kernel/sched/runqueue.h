@@ -0,0 +1,71 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_RUNQUEUE_H
+#define UNTITLED_OS_RUNQUEUE_H
+
+#include <inttypes.h>
+#include "../lib/include/rbtree.h"
+#include "sched_states.h"
+
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+#define NICE_0_WEIGHT 1024
+
+// Virtual runtime a waking thread may be behind the queue's minimum,
+// so a thread that slept runs soon but cannot bank its sleep
+#define SCHED_WAKEUP_CREDIT 3000000UL // ~1.5 ms of TSC at 2 GHz
+
+// A thread, or a process as a group of threads, competing for the
+// CPU. vruntime is the time it ran in TSC cycles, scaled by
+// NICE_0_WEIGHT / weight, so heavier entities age slower.
+struct sched_entity {
+    struct rb_node node;         // in the cfs_rq tree, by vruntime
+    uint64_t vruntime;
+    uint32_t weight;
+    int on_rq;
+    uint64_t exec_start;         // TSC when a thread was last picked or charged
+};
+
+// Runnable entities ordered by vruntime; the leftmost runs next
+struct cfs_rq {
+    struct rb_root tree;
+    struct rb_node *leftmost;
+    uint64_t min_vruntime;       // never goes back, new entities start here
+    uint32_t nr_running;         // entities in the tree
+};
+
+// A process's share of one CPU: its group entity in that CPU's run
+// queue and its threads queued there
+struct proc_sched {
+    struct sched_entity se;
+    struct cfs_rq cfs;
+};
+
+#define REBALANCE_TICKS 8      // picks between periodic load balancing
+#define WAKE_AFFINE_SLACK 1    // extra load tolerated to stay cache-warm
+
+struct thread;
+struct proc;
+
+void rq_init(void);
+
+void sched_init_thread(struct thread *thread);
+
+void sched_init_proc(struct proc *proc);
+
+void rq_change_state(struct thread *thread, enum sched_states state);
+
+struct thread *rq_pick_next(struct thread *prev);
+
+void thread_set_nice(struct thread *thread, int nice);
+
+void proc_set_weight(struct proc *proc, uint32_t weight);
+
+int thread_set_affinity(struct thread *thread, uint64_t mask);
+
+uint32_t rq_nr_running(void);
+
+#endif //UNTITLED_OS_RUNQUEUE_H
@@ -8,55 +8,73 @@
 #include "threads.h"
 #include "../lib/include/x86_64.h"
 #include "../lib/include/panic.h"
+#include "../paging/tlb.h"
+#include "../vm/vm.h"
 
-struct context kcontext;
-struct context *kcontext_ptr = &kcontext;
-uint32_t current_proc_rounds = 0;
-
-struct thread *get_next_thread() {
-    if (proc_list == 0) panic("schedule: no procs");
-    struct proc *first_proc = peek_proc_list(proc_list);
-    struct proc *current_proc;
-
-    if (current_proc_rounds >= ROUNDS_PER_PROC) {
-        current_proc_rounds = 0;
-        shift_proc_list(&proc_list);
-    }
-
-    do {
-        current_proc = peek_proc_list(proc_list);
-
-        // If proc has threads
-        if (current_proc->threads == 0) panic("schedule: proc with no threads\n");
+// Switch this CPU from its thread, or its idle loop, to the next
+// runnable thread, or back to the idle loop if there is none. Called
+// with interrupts off, from the timer or through yield.
+//
+// A preempted thread is back on the run queue before its registers
+// are saved, so another CPU may pick it while this one is still on
+// its stack. on_cpu stays set until the switch is over, and whoever
+// picks the thread waits for it to clear.
+void schedule(void) {
+    vm_refill_stack_reserve();
 
-        struct thread *first_thread = peek_thread_list(current_proc->threads);
-        struct thread *current_thread;
+    struct thread *prev = this_cpu_read(current_thread);
+    struct thread *next = rq_pick_next(prev);
 
-        do {
-            current_thread = peek_thread_list(current_proc->threads);
-            shift_thread_list(&(current_proc->threads));
-            if (current_thread->state == RUNNABLE) {
-                return current_thread;
-            }
-        } while (peek_thread_list(current_proc->threads) != first_thread);
+    if (next == prev)
+        return;
 
-        current_proc_rounds = 0;
-        shift_proc_list(&proc_list);
-    } while (peek_proc_list(proc_list) != first_proc);
+    this_cpu_write(current_thread, next);
+    this_cpu_write(prev_thread, prev);
+    this_cpu_inc(nr_switches);
+    struct context **from = prev ? &prev->context : &mycpu()->scheduler;
+    if (next == 0) {
+        switch_context(from, this_cpu_read(scheduler));
+    } else {
+        while (next->on_cpu)
+            tlb_shootdown_handler();
+        next->on_cpu = 1;
+        switchuvm(next->proc);
+        switch_context(from, next->context);
+    }
+    finish_switch();
+}
 
-    panic("shcedule: no available threads\n");
+// First thing after a switch, on the new stack and maybe another CPU
+// than the one the switch started on: let go of the thread left behind
+void finish_switch(void) {
+    struct thread *prev = this_cpu_read(prev_thread);
+    if (prev != 0) {
+        __sync_synchronize();
+        prev->on_cpu = 0;
+        this_cpu_write(prev_thread, 0);
+    }
 }
 
+// Idle loop of an application processor. Its timer switches to
+// threads from here, and back here when none is runnable.
 void scheduler() {
-    while (1) {
-        //printf("scheduling\n");
-        struct thread *next_thread = get_next_thread();
-        current_cpu.current_thread = next_thread;
-        switch_context(&kcontext_ptr, next_thread->context);
-    }
+    sti();
+    while (1)
+        asm volatile("hlt");
 }
 
+// Give up the CPU. A thread that just blocked does not come back until
+// it is runnable again.
 void yield() {
-    //printf("yield\n");
-    switch_context(&(current_cpu.current_thread->context), kcontext_ptr);
-}
\ No newline at end of file
+    int intena = readeflags() & FL_INT;
+    cli();
+    schedule();
+    if (intena)
+        sti();
+}
+
+void sched_print_stats(void) {
+    printf("cpu  switches  migrations\n");
+    for (int i = 0; i < ncpu; i++)
+        printf("%d  %d  %d\n", i, (int) cpus[i].nr_switches, (int) cpus[i].nr_migrations);
+}
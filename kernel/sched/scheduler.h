@@ -7,10 +7,12 @@
 #define UNTITLED_OS_SHEDULER_H
 #include "proc.h"
 #include "threads.h"
-#define ROUNDS_PER_PROC 5
+#include "runqueue.h"
 
-struct thread *get_next_thread(void);
+void schedule(void);
+void finish_switch(void);
 void scheduler(void);
 void yield(void);
+void sched_print_stats(void);
 
 #endif //UNTITLED_OS_SHEDULER_H
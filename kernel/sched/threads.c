@@ -7,37 +7,77 @@
 #include "sched_states.h"
 #include "../lib/include/panic.h"
 #include "scheduler.h"
+#include "proc.h"
+#include "runqueue.h"
+#include "../vm/vm.h"
+#include "../paging/paging.h"
+#include "../kalloc/slab.h"
 
-struct thread *current_thread = 0;
+static struct kmem_cache *thread_cache;
+static struct kmem_cache *thread_node_cache;
+
+void threadinit(void) {
+    thread_cache = kmem_cache_create("thread", sizeof(struct thread), CACHE_LINE_SIZE, 0);
+    thread_node_cache = kmem_cache_create("thread_node", sizeof(struct thread_node), 0, 0);
+}
+
+// Where a new thread's first switch returns to: finish that switch,
+// then run the thread's function with interrupts on. A thread whose
+// function returns exits.
+static void thread_start(void) {
+    finish_switch();
+    sti();
+
+    struct thread *thread = mythread();
+    ((void (*)(int, struct argument *)) thread->start_function)(thread->argc, thread->args);
+
+    cli();
+    change_thread_state(thread, EXIT);
+    schedule();
+    panic("thread_start: exited thread ran");
+}
 
 void init_thread(struct thread *thread, void (*start_function)(void *), int argc, struct argument *args) {
-    thread->stack = kalloc();
-    thread->kstack = kalloc();
-    memset(thread->stack, 0, PGSIZE);
-    memset(thread->kstack, 0, PGSIZE);
+    // Only the top page is backed, the rest faults in as the stack grows.
+    // The initial frame is set up below, before faults can be handled.
+    // Threads take cache colors in turn, so hot threads' stacks do not
+    // evict each other; the kernel stack sits half the colors away.
+    uint32_t color = kalloc_next_color();
+    thread->stack_area = vm_reserve(THREAD_STACK_SIZE, PTE_W, VM_STACK);
+    if (thread->stack_area != 0)
+        thread->stack_area->color = color;
+    if (thread->stack_area == 0 ||
+        vm_populate(thread->stack_area, thread->stack_area->end - PGSIZE, PGSIZE) != 0) {
+        panic("init_thread: no stack");
+    }
+    thread->stack = thread->stack_area->end;
+    thread->kstack = kalloc_color(color + kalloc_ncolors() / 2, KALLOC_NOINIT);
     thread->kstack += PGSIZE;
-    thread->stack += PGSIZE;
     thread->start_function = start_function;
     thread->argc = argc;
     thread->args = args;
+    // The switch pops the registers and returns to thread_start with
+    // the stack aligned as after a call
     char *sp = thread->stack;
-    sp -= sizeof(uint64_t);     
-    *(uint64_t * )(sp) = start_function;
+    sp -= 2 * sizeof(uint64_t);
+    *(uint64_t * )(sp) = (uint64_t) thread_start;
     sp -= sizeof(struct context) - sizeof(uint64_t);
     memset(sp, 0, sizeof(struct context) - sizeof(uint64_t));
     thread->context = (struct context *) sp;
-    thread->context->rdi = argc;
-    thread->context->rsi = args;
 }
 
 struct thread *create_thread(void (*start_function)(void *), int argc, struct argument *args) {
-    struct thread *new_thread = (struct thread *) kalloc();
+    struct thread *new_thread = (struct thread *) kmem_cache_alloc(thread_cache);
+    new_thread->proc = 0;
+    new_thread->state = NEW;
+    new_thread->on_cpu = 0;
+    sched_init_thread(new_thread);
     init_thread(new_thread, start_function, argc, args);
     return new_thread;
 }
 
 void push_thread_list(struct thread_node **list, struct thread *thread) {
-    struct thread_node *new_node = kalloc();
+    struct thread_node *new_node = kmem_cache_alloc(thread_node_cache);
     new_node->data = thread;
     if ((*list) != 0) {
         new_node->next = (*list);
@@ -57,12 +97,12 @@ struct thread *pop_thread_list(struct thread_node **list) {
     } else {
         struct thread* t = (*list)->data;
         if ((*list)->next = (*list)) {
-            kfree(*list);
+            kmem_cache_free(thread_node_cache, *list);
             *list = 0;
         } else {
             (*list)->prev->next = (*list)->next;
             (*list)->next->prev = (*list)->prev;
-            kfree(*list);
+            kmem_cache_free(thread_node_cache, *list);
         }
         return t;
     }
@@ -85,5 +125,5 @@ struct thread *peek_thread_list(struct thread_node *list) {
 }
 
 void change_thread_state(struct thread *thread, enum sched_states new_state) {
-    thread->state = new_state;
+    rq_change_state(thread, new_state);
 }
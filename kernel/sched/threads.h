@@ -13,20 +13,35 @@
 #include <inttypes.h>
 #include "../lib/include/memset.h"
 #include "sched_states.h"
+#include "runqueue.h"
+
+#define THREAD_STACK_SIZE (64 * 1024) // reserved per thread, backed on demand
+#define STACK_RESERVE_PAGES 4         // zeroed frames per CPU for stack faults, see vm_fault
 
 struct argument {
     char *value;
     size_t arg_size;
 };
 
+struct proc;
+struct vm_area;
+
 struct thread {
     struct context *context;
+    struct proc *proc;
     void (*start_function)(void *);
     uint64_t stack;
+    struct vm_area *stack_area;
     uint64_t kstack;
     size_t argc;
     struct argument *args;
     enum sched_states state;
+    int nice;                    // NICE_MIN .. NICE_MAX, sets se.weight
+    struct sched_entity se;      // in its proc's cfs_rq while RUNNABLE
+    volatile int on_cpu;         // a CPU is on its stack, see schedule()
+    int cpu;                     // run queue it is on or last ran on
+    uint64_t affinity;           // CPUs it may run on
+    int wake_pending;            // woken while still ON_CPU, see rq_change_state
 };
 
 struct thread_node {
@@ -35,6 +50,8 @@ struct thread_node {
     struct thread_node *prev;
 };
 
+void threadinit(void);
+
 void push_thread_list(struct thread_node **list, struct thread *thread);
 
 struct thread *pop_thread_list(struct thread_node **list);
@@ -4,11 +4,27 @@
 //
 
 #include "mutex.h"
+#include "../kalloc/slab.h"
+#include "../lib/include/panic.h"
 
+static struct kmem_cache *spinlock_cache;
+
+// Set up the cache mutexes take their spinlocks from, once at boot
+// before any mutex exists
+void mutexinit(void) {
+    spinlock_cache = kmem_cache_create("spinlock", sizeof(struct spinlock), 0, 0);
+    if (spinlock_cache == 0)
+        panic("mutexinit");
+}
+
+// Returns 0, or -1 if there is no memory for the spinlock
 int init_mutex(struct mutex *lk, char *name) {
-    lk->spinlock = kalloc();
+    lk->spinlock = kmem_cache_alloc(spinlock_cache);
+    if (lk->spinlock == 0)
+        return -1;
     lk->thread_list = 0;
     init_spinlock(lk->spinlock, name);
+    return 0;
 }
 
 void acquire_mutex(struct mutex *lk) {
@@ -16,13 +32,13 @@ void acquire_mutex(struct mutex *lk) {
         panic("panic in acquire_mutex");
     }
     check_mutex:
-    int bool = holding_spinlock(lk->spinlock);
-    if (bool == 0) {
+    int held = holding_spinlock(lk->spinlock);
+    if (held == 0) {
         acquire_spinlock(lk->spinlock);
         return;
     } else {
-        push_thread_list(&lk->thread_list, current_cpu.current_thread);
-        change_thread_state(current_cpu.current_thread, WAIT);
+        push_thread_list(&lk->thread_list, mythread());
+        change_thread_state(mythread(), WAIT);
         yield();
         if(holding_spinlock(lk->spinlock) != 0) panic("acquire_mutex: spinlock in not free");
         goto check_mutex;
@@ -43,5 +59,5 @@ void release_mutex(struct mutex *lk) {
 }
 
 void destroy_mutex(struct mutex *lk) {
-    kfree(lk);
+    kmem_cache_free(spinlock_cache, lk->spinlock);
 }
\ No newline at end of file
@@ -16,6 +16,8 @@ struct mutex {
     struct thread_node *thread_list;
 };
 
+void mutexinit(void);
+
 int init_mutex(struct mutex *lk, char *name);
 
 void acquire_mutex(struct mutex *lk);
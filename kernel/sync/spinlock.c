@@ -4,12 +4,12 @@
 //
 
 #include "spinlock.h"
-// Eflags register
-#define FL_INT           0x00000200      // Interrupt Enable
+#include "../paging/tlb.h"
 
 void init_spinlock(struct spinlock *lock, char *name) {
     lock->is_locked = 0;
     lock->name = name;
+    lock->cpu = -1;
 }
 
 //bool function
@@ -20,19 +20,23 @@ void acquire_spinlock(struct spinlock *lk) {
 //        return 1;
 //    }
 
-    // The xchg is atomic.
-    while (xchg(&lk->is_locked, 1) != 0);
+    // The xchg is atomic. Interrupts are off while spinning, so keep
+    // answering TLB shootdowns in case the holder is waiting on us.
+    while (xchg(&lk->is_locked, 1) != 0)
+        tlb_shootdown_handler();
 
     // Tell the C compiler and the processor to not move loads or stores
     // past this point, to ensure that the critical section's memory
     // references happen after the lock is acquire_spinlockd.
     __sync_synchronize();
+    lk->cpu = cpuid();
     return;
 }
 
 void release_spinlock(struct spinlock *lk) {
     if (!holding_spinlock(lk))
         panic("release_spinlock");
+    lk->cpu = -1;
 
     // Tell the C compiler and the processor to not move loads or stores
     // past this point, to ensure that all the stores in the critical
@@ -57,21 +61,31 @@ int holding_spinlock(struct spinlock *lock) {
     return r;
 }
 
+// Held by this CPU, for code that would wait on itself otherwise
+int holding_spinlock_here(struct spinlock *lock) {
+    int r;
+    pushcli();
+    r = lock->is_locked && lock->cpu == cpuid();
+    popcli();
+    return r;
+}
+
 void pushcli(void) {
     int eflags;
 
     eflags = readeflags();
     cli();
-    if (current_cpu.ncli == 0)
-        current_cpu.intena = eflags & FL_INT;
-    current_cpu.ncli += 1;
+    if (this_cpu_read(ncli) == 0)
+        this_cpu_write(intena, eflags & FL_INT);
+    this_cpu_inc(ncli);
 }
 
 void popcli(void) {
     if (readeflags() & FL_INT)
         panic("popcli - interruptible");
-    if (--current_cpu.ncli < 0)
+    this_cpu_dec(ncli);
+    if (this_cpu_read(ncli) < 0)
         panic("popcli");
-    if (current_cpu.ncli == 0 && current_cpu.intena)
+    if (this_cpu_read(ncli) == 0 && this_cpu_read(intena))
         sti();
 }
@@ -14,6 +14,7 @@
 struct spinlock {
     uint8_t is_locked;
     char *name;
+    int cpu;                     // holder's cpuid(), -1 when free
 };
 
 void init_spinlock(struct spinlock *lock, char *name);
@@ -24,4 +25,10 @@ void release_spinlock(struct spinlock *lk);
 
 int holding_spinlock(struct spinlock *lock);
 
+int holding_spinlock_here(struct spinlock *lock);
+
+void pushcli(void);
+
+void popcli(void);
+
 #endif //UNTITLED_OS_SPINLOCK_H
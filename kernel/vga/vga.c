@@ -6,8 +6,15 @@
 
 #include "vga.h"
 #include "../lib/include/memset.h"
+#include "../memlayout.h"
+#include "../lib/include/x86_64.h"
+#include "../paging/paging.h"
+#include "../memmap/memmap.h"
+#include "../memmap/multiboot.h"
+#include "../vm/vm.h"
 struct vga_char;
-struct char_with_color *const VGA_ADDRESS = (void *) 0xB8000;
+struct char_with_color *VGA_ADDRESS = PHYS_TO_VIRT(VGA_PHYS);
+void *framebuffer; // linear framebuffer, when booted in a graphics mode
 static int line = 0;
 static int pos = 0;
 static enum vga_colors fg = DEFAULT_FG_COLOR;
@@ -24,4 +31,23 @@ void write_buffer(struct char_with_color *tty_buffer) {
     for (int i = 0; i < VGA_HEIGHT * VGA_WIDTH; i++) {
         VGA_ADDRESS[i] = tty_buffer[i];
     }
+    // Push the screen out of the write-combining buffers
+    sfence();
+}
+
+// Until now the screen is written through the boot direct map, where
+// the MTRRs make it uncached: one bus cycle per character. Remap it
+// write-combining so a redraw goes out in bursts. Needs vm_init.
+void vga_map_wc(void) {
+    struct boot_framebuffer *fb = &boot_framebuffer;
+
+    if (fb->addr != 0 && fb->type != MULTIBOOT_FRAMEBUFFER_TYPE_EGA_TEXT) {
+        framebuffer = ioremap(fb->addr, (uint64_t) fb->pitch * fb->height, PTE_WC);
+        return;
+    }
+
+    struct char_with_color *text = ioremap(fb->addr ? fb->addr : VGA_PHYS,
+                                           VGA_WIDTH * VGA_HEIGHT * sizeof(struct char_with_color), PTE_WC);
+    if (text)
+        VGA_ADDRESS = text;
 }
\ No newline at end of file
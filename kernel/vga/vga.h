@@ -9,6 +9,7 @@
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
 #define VGA_COLOR 7
+#define VGA_PHYS 0xB8000 // text mode buffer
 //#include "../lib/include/stdint.h"
 #include <inttypes.h>
 #define DEFAULT_BG_COLOR VGA_COLOR_WHITE
@@ -39,4 +40,7 @@ struct __attribute__((packed)) char_with_color {
 
 void clear_vga();
 void write_buffer(struct char_with_color *tty_buffer);
+void vga_map_wc();
+
+extern void *framebuffer;
 #endif //UNTITLED_OS_PRINT_H
\ No newline at end of file
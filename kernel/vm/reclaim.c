@@ -0,0 +1,225 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "reclaim.h"
+#include "../kalloc/kalloc.h"
+#include "../sync/spinlock.h"
+#include "../tty/tty.h"
+
+// Page reclaim.
+//
+// Anonymous small pages of processes sit on two LRU lists. Pages
+// faulted in start on the inactive list; reclaim takes pages from its
+// tail and swaps out those whose accessed bit is clear, while
+// referenced ones move to the active list. The active list is aged by
+// moving its tail back to the inactive list whenever it grows larger.
+// Shrinkers are asked for their pages before anything is swapped.
+//
+// Reclaim takes proc_lock, uvm_lock, zswap_lock and ata_lock, and
+// polls the disk with interrupts off, so it only runs where no
+// spinlock is held: from the idle loop when free memory drops below
+// the low watermark, and from callers that can retry a failed
+// allocation (allocproc, and page faults that interrupted no lock
+// holder). kalloc itself never reclaims.
+// Huge pages and pages shared after a fork are not reclaimed.
+
+#define LRU_PAGE(l) ((struct page *) ((char *) (l) - __builtin_offsetof(struct page, lru)))
+
+static struct spinlock lru_lock;
+static struct list active_list;
+static struct list inactive_list;
+static uint64_t nr_active;
+static uint64_t nr_inactive;
+static struct list shrinkers;
+static struct reclaim_stats stats;
+static int reclaiming; // background reclaim runs until the high watermark
+
+void reclaim_init(void) {
+    init_spinlock(&lru_lock, "lru");
+    lst_init(&active_list);
+    lst_init(&inactive_list);
+    lst_init(&shrinkers);
+}
+
+// Register before any other CPU is running
+void register_shrinker(struct shrinker *shrinker) {
+    lst_push(&shrinkers, &shrinker->link);
+}
+
+// Put a page just mapped at index in owner's address space on the
+// inactive list, or record its new owner if it is on a list already
+void lru_add(void *va, uint64_t owner, uint64_t index) {
+    struct page *page = va2page(va);
+
+    acquire_spinlock(&lru_lock);
+    page->owner = owner;
+    page->index = index;
+    if (!(page->flags & PG_LRU)) {
+        page->flags = (page->flags | PG_LRU) & ~PG_ACTIVE;
+        lst_push(&inactive_list, &page->lru);
+        nr_inactive++;
+    }
+    release_spinlock(&lru_lock);
+}
+
+// Called by kfree for pages still on a list
+void lru_del(void *va) {
+    struct page *page = va2page(va);
+
+    acquire_spinlock(&lru_lock);
+    if ((page->flags & (PG_LRU | PG_ISOLATED)) == PG_LRU) {
+        lst_remove(&page->lru);
+        if (page->flags & PG_ACTIVE)
+            nr_active--;
+        else
+            nr_inactive--;
+    }
+    page->flags &= ~(PG_LRU | PG_ACTIVE | PG_ISOLATED);
+    release_spinlock(&lru_lock);
+}
+
+// Take a reference unless the page is already on its way to kfree
+static int page_get_unless_zero(struct page *page) {
+    uint16_t refs = page->refs;
+    while (refs != 0) {
+        uint16_t seen = __sync_val_compare_and_swap(&page->refs, refs, refs + 1);
+        if (seen == refs)
+            return 1;
+        refs = seen;
+    }
+    return 0;
+}
+
+// Move pages from the active tail to the inactive head until the
+// inactive list is at least as long. Called with lru_lock held.
+static void age_active(void) {
+    while (nr_inactive < nr_active) {
+        struct page *page = LRU_PAGE(active_list.prev);
+        lst_remove(&page->lru);
+        page->flags &= ~PG_ACTIVE;
+        lst_push(&inactive_list, &page->lru);
+        nr_active--;
+        nr_inactive++;
+        stats.deactivated++;
+    }
+}
+
+// Take the coldest inactive page off the lists with a reference held,
+// or return 0 if there is none. The page keeps PG_LRU, so lru_add
+// leaves it alone until putback.
+static struct page *isolate_inactive(void) {
+    struct page *page = 0;
+
+    acquire_spinlock(&lru_lock);
+    age_active();
+    while (page == 0 && nr_inactive > 0) {
+        struct page *p = LRU_PAGE(inactive_list.prev);
+        lst_remove(&p->lru);
+        nr_inactive--;
+        if (page_get_unless_zero(p)) {
+            p->flags |= PG_ISOLATED;
+            page = p;
+        } else {
+            p->flags &= ~PG_LRU; // kfree is on its way
+        }
+    }
+    release_spinlock(&lru_lock);
+
+    return page;
+}
+
+static void putback(struct page *page, int active) {
+    acquire_spinlock(&lru_lock);
+    page->flags = (page->flags & ~PG_ISOLATED) | (active ? PG_ACTIVE : 0);
+    lst_push(active ? &active_list : &inactive_list, &page->lru);
+    if (active)
+        nr_active++;
+    else
+        nr_inactive++;
+    release_spinlock(&lru_lock);
+
+    page_put(page2va(page));
+}
+
+static uint64_t run_shrinkers(uint64_t nr) {
+    uint64_t freed = 0;
+
+    for (struct list *l = shrinkers.next; l != &shrinkers && freed < nr; l = l->next) {
+        struct shrinker *shrinker = (struct shrinker *) l;
+        if (shrinker->count() > 0)
+            freed += shrinker->scan(nr - freed);
+    }
+    __sync_fetch_and_add(&stats.shrunk, freed);
+    return freed;
+}
+
+static uint64_t do_reclaim(uint64_t nr) {
+    uint64_t freed = run_shrinkers(nr);
+    uint64_t budget = nr_active + nr_inactive;
+
+    while (freed < nr && budget-- > 0) {
+        struct page *page = isolate_inactive();
+        if (page == 0)
+            break;
+        __sync_fetch_and_add(&stats.scanned, 1);
+
+        void *va = page2va(page);
+        switch (uvm_reclaim_page(va)) {
+            case RECLAIM_SWAPPED:
+                __sync_fetch_and_add(&stats.swapped_out, 1);
+                page_put(va); // the last reference, frees the page
+                freed++;
+                break;
+            case RECLAIM_REFERENCED:
+                __sync_fetch_and_add(&stats.activated, 1);
+                putback(page, 1);
+                break;
+            default:
+                putback(page, 0);
+                break;
+        }
+    }
+
+    return freed;
+}
+
+// Try to free nr pages, from shrinkers first, then by swapping out
+// inactive pages. Each LRU page is looked at most once. Returns the
+// number of pages freed. Must be called with no locks held.
+uint64_t reclaim_pages(uint64_t nr) {
+    __sync_fetch_and_add(&stats.direct, 1);
+    return do_reclaim(nr);
+}
+
+// Reclaim a batch from the idle loop if free memory is below the low
+// watermark, or still below the high one since the last call.
+// Returns 1 if it did anything.
+int reclaim_idle(void) {
+    struct kmem_stats mem;
+    kmem_get_stats(&mem);
+
+    if (mem.free_pages >= mem.total_pages / RECLAIM_HIGH)
+        reclaiming = 0;
+    else if (mem.free_pages < mem.total_pages / RECLAIM_LOW)
+        reclaiming = 1;
+    if (!reclaiming)
+        return 0;
+
+    stats.background++;
+    if (do_reclaim(RECLAIM_BATCH) == 0)
+        reclaiming = 0; // nothing left to take, wait for the next low
+    return 1;
+}
+
+void reclaim_get_stats(struct reclaim_stats *out) {
+    *out = stats;
+}
+
+void reclaim_print_stats(void) {
+    printf("lru: active %d inactive %d\n", (int) nr_active, (int) nr_inactive);
+    printf("reclaim: scanned %d activated %d deactivated %d swapped out %d shrunk %d direct %d background %d\n",
+           (int) stats.scanned, (int) stats.activated, (int) stats.deactivated, (int) stats.swapped_out,
+           (int) stats.shrunk, (int) stats.direct, (int) stats.background);
+}
@@ -0,0 +1,60 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_RECLAIM_H
+#define UNTITLED_OS_RECLAIM_H
+
+#include <inttypes.h>
+#include "../list/list.h"
+
+#define RECLAIM_BATCH 32 // pages a failed allocation asks reclaim for before retrying
+
+// Free memory below total / RECLAIM_LOW starts background reclaim,
+// which goes on until it is above total / RECLAIM_HIGH
+#define RECLAIM_LOW 32
+#define RECLAIM_HIGH 16
+
+// What uvm_reclaim_page did with a page
+#define RECLAIM_SWAPPED 0    // written out and unmapped
+#define RECLAIM_REFERENCED 1 // used since the last look, goes back on the active list
+#define RECLAIM_KEEP 2       // cannot go now: shared, being unmapped, or no swap left
+
+// A cache that can give pages back under memory pressure
+struct shrinker {
+    struct list link;
+    char *name;
+    uint64_t (*count)(void);       // pages it could free now
+    uint64_t (*scan)(uint64_t nr); // free up to nr pages, returns how many it did
+};
+
+struct reclaim_stats {
+    uint64_t scanned;      // pages taken off the inactive list
+    uint64_t activated;    // found referenced
+    uint64_t deactivated;  // moved from the active to the inactive list
+    uint64_t swapped_out;
+    uint64_t shrunk;       // pages given back by shrinkers
+    uint64_t direct;       // reclaim_pages calls from failed allocations
+    uint64_t background;   // batches run from the idle loop
+};
+
+void reclaim_init(void);
+
+void register_shrinker(struct shrinker *shrinker);
+
+void lru_add(void *va, uint64_t owner, uint64_t index);
+
+void lru_del(void *va);
+
+uint64_t reclaim_pages(uint64_t nr);
+
+int reclaim_idle(void);
+
+void reclaim_get_stats(struct reclaim_stats *stats);
+
+void reclaim_print_stats(void);
+
+int uvm_reclaim_page(void *va);
+
+#endif //UNTITLED_OS_RECLAIM_H
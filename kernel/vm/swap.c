@@ -0,0 +1,128 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "swap.h"
+#include "zswap.h"
+#include "../ata/ata.h"
+#include "../memlayout.h"
+#include "../kalloc/kmalloc.h"
+#include "../sync/spinlock.h"
+#include "../lib/include/panic.h"
+#include "../tty/tty.h"
+
+// Swap area: the whole ATA disk, cut into page-sized slots. A swapped
+// out page leaves its slot number in the PTE (see PTE_SWAP), and the
+// slot counts the entries pointing at it, since fork copies them.
+// Slot 0 is never handed out so a slot number is never 0.
+//
+// Pages go to zswap first and only reach the disk if they do not
+// compress. Without a disk there are still slots, backed by zswap
+// alone, so that memory can be overcommitted on compressible data.
+
+#define ZSWAP_ONLY_SLOTS 2 // slots per page of RAM when there is no disk
+
+#define SLOT_SECTORS (PGSIZE / ATA_SECTOR_SIZE)
+
+static struct spinlock swap_lock;
+static uint16_t *swap_map; // entries referencing each slot
+static uint64_t nslots;
+static uint64_t disk_slots;
+static uint64_t nr_used;
+static uint64_t next_slot; // where the search for a free slot starts
+static uint64_t writes;
+static uint64_t reads;
+
+void swap_init(void) {
+    init_spinlock(&swap_lock, "swap");
+
+    disk_slots = ata_init() / SLOT_SECTORS;
+    nslots = disk_slots;
+    if (nslots == 0) {
+        struct kmem_stats mem;
+        kmem_get_stats(&mem);
+        nslots = mem.total_pages * ZSWAP_ONLY_SLOTS;
+        printf("swap: no disk, compressed memory only\n");
+    }
+    if (nslots > SWAP_MAX_SLOTS)
+        nslots = SWAP_MAX_SLOTS;
+    if ((swap_map = kcalloc(nslots, sizeof(uint16_t))) == 0)
+        panic("swap_init");
+
+    swap_map[0] = 1;
+    nr_used = 1;
+    next_slot = 1;
+    printf("swap: %d pages\n", (int) nslots - 1);
+    zswap_init(nslots);
+}
+
+// A free slot with one reference, or 0 if swap is full or missing
+uint64_t swap_alloc(void) {
+    uint64_t slot = 0;
+
+    acquire_spinlock(&swap_lock);
+    if (nr_used < nslots) {
+        for (slot = next_slot; swap_map[slot] != 0; )
+            slot = slot + 1 < nslots ? slot + 1 : 1;
+        swap_map[slot] = 1;
+        nr_used++;
+        next_slot = slot + 1 < nslots ? slot + 1 : 1;
+    }
+    release_spinlock(&swap_lock);
+
+    return slot;
+}
+
+// Another swap entry now points at slot
+void swap_dup(uint64_t slot) {
+    acquire_spinlock(&swap_lock);
+    if (slot == 0 || slot >= nslots || swap_map[slot] == 0 || swap_map[slot] == UINT16_MAX)
+        panic("swap_dup");
+    swap_map[slot]++;
+    release_spinlock(&swap_lock);
+}
+
+void swap_free(uint64_t slot) {
+    acquire_spinlock(&swap_lock);
+    if (slot == 0 || slot >= nslots || swap_map[slot] == 0)
+        panic("swap_free");
+    int last = --swap_map[slot] == 0;
+    if (last)
+        nr_used--;
+    release_spinlock(&swap_lock);
+
+    if (last)
+        zswap_invalidate(slot);
+}
+
+int swap_write(uint64_t slot, void *page) {
+    if (zswap_store(slot, page) == 0)
+        return 0;
+    if (slot >= disk_slots)
+        return -1;
+    __sync_fetch_and_add(&writes, 1);
+    return ata_write(slot * SLOT_SECTORS, SLOT_SECTORS, page);
+}
+
+int swap_read(uint64_t slot, void *page) {
+    if (zswap_load(slot, page) == 0)
+        return 0;
+    __sync_fetch_and_add(&reads, 1);
+    return ata_read(slot * SLOT_SECTORS, SLOT_SECTORS, page);
+}
+
+void swap_get_stats(struct swap_stats *stats) {
+    stats->total_slots = nslots ? nslots - 1 : 0;
+    stats->used_slots = nslots ? nr_used - 1 : 0;
+    stats->writes = writes;
+    stats->reads = reads;
+}
+
+void swap_print_stats(void) {
+    struct swap_stats stats;
+    swap_get_stats(&stats);
+    printf("swap: %d of %d pages used, %d written, %d read\n", (int) stats.used_slots,
+           (int) stats.total_slots, (int) stats.writes, (int) stats.reads);
+    zswap_print_stats();
+}
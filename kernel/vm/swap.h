@@ -0,0 +1,36 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_SWAP_H
+#define UNTITLED_OS_SWAP_H
+
+#include <inttypes.h>
+
+#define SWAP_MAX_SLOTS (1UL << 18) // 1 GiB of swap at most
+
+struct swap_stats {
+    uint64_t total_slots;
+    uint64_t used_slots;
+    uint64_t writes;      // pages written to disk, zswap aside
+    uint64_t reads;       // pages read back from disk
+};
+
+void swap_init(void);
+
+uint64_t swap_alloc(void);
+
+void swap_dup(uint64_t slot);
+
+void swap_free(uint64_t slot);
+
+int swap_write(uint64_t slot, void *page);
+
+int swap_read(uint64_t slot, void *page);
+
+void swap_get_stats(struct swap_stats *stats);
+
+void swap_print_stats(void);
+
+#endif //UNTITLED_OS_SWAP_H
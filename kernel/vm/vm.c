@@ -1,2 +1,830 @@
-// Eflags register
-#define FL_INT           0x00000200      // Interrupt Enable
\ No newline at end of file
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "vm.h"
+#include "../memlayout.h"
+#include "../paging/paging.h"
+#include "../paging/tlb.h"
+#include "../kalloc/kalloc.h"
+#include "../sync/spinlock.h"
+#include "../lib/include/panic.h"
+#include "../tty/tty.h"
+#include "../lib/include/memcpy.h"
+#include "../sched/proc.h"
+#include "../kalloc/slab.h"
+#include "swap.h"
+#include "reclaim.h"
+
+// Kernel virtual memory in [KVM_BASE, KVM_END) is handed out by two
+// red-black trees: reserved areas ordered by address, for lookups on
+// faults and frees, and the free ranges between them, each node also
+// holding the largest free size in its subtree so the lowest fitting
+// range is found in one descent. Every area takes an extra unmapped
+// page next to it (below a stack, above anything else), so running
+// off the end of an area faults instead of hitting its neighbour.
+
+// A free range of the kernel area
+struct vm_free {
+    struct rb_node node;
+    uint64_t start;
+    uint64_t size;
+    uint64_t subtree_max; // largest size in this subtree
+};
+
+static struct spinlock vm_lock;
+static struct spinlock uvm_lock; // process page tables and heap sizes
+static struct rb_root areas;
+static struct rb_root free_ranges;
+static struct kmem_cache *area_cache;
+static struct kmem_cache *free_cache;
+
+// Transparent huge pages: a heap fault in an aligned 2 MiB chunk that
+// lies wholly below brk takes a free 2 MiB block and maps it with one
+// PDE. Such a page is split back into 512 small mappings when only
+// part of it is to be copied or unmapped, and thp_scan collapses
+// chunks that filled up page by page into a large page again.
+#define THP_ORDER 9        // a 2 MiB block is 2^9 pages
+#define THP_SCAN_CHUNKS 8  // chunks looked at per thp_scan call
+
+static struct thp_stats thp_stats;
+static struct {
+    pid_t pid;             // process being scanned
+    uint64_t va;           // next chunk to look at
+    uint64_t round;        // heap_faults when the current round began
+    int idle;              // the last round saw no heap fault
+} thp_cursor;
+// Heap faults resolved, under uvm_lock. Only a fault can complete a
+// chunk, so thp_scan rests while this does not move.
+static volatile uint64_t heap_faults;
+
+#define FREE(n) rb_entry(n, struct vm_free, node)
+#define AREA(n) rb_entry(n, struct vm_area, node)
+
+static inline uint64_t subtree_max(struct rb_node *node) {
+    return node ? FREE(node)->subtree_max : 0;
+}
+
+static uint64_t compute_max(struct vm_free *f) {
+    uint64_t max = f->size;
+    if (subtree_max(f->node.left) > max)
+        max = subtree_max(f->node.left);
+    if (subtree_max(f->node.right) > max)
+        max = subtree_max(f->node.right);
+    return max;
+}
+
+static void free_propagate(struct rb_node *node, struct rb_node *stop) {
+    while (node != stop) {
+        uint64_t max = compute_max(FREE(node));
+        if (FREE(node)->subtree_max == max)
+            break;
+        FREE(node)->subtree_max = max;
+        node = rb_parent(node);
+    }
+}
+
+static void free_copy(struct rb_node *old, struct rb_node *new) {
+    FREE(new)->subtree_max = FREE(old)->subtree_max;
+}
+
+static void free_rotate(struct rb_node *old, struct rb_node *new) {
+    FREE(new)->subtree_max = FREE(old)->subtree_max;
+    FREE(old)->subtree_max = compute_max(FREE(old));
+}
+
+static const struct rb_augment free_augment = {
+    free_propagate, free_copy, free_rotate
+};
+
+// Take size bytes from the lowest free range that fits. Returns 0 if
+// nothing does.
+static uint64_t free_take(uint64_t size) {
+    struct rb_node *node = free_ranges.node;
+
+    while (node) {
+        if (subtree_max(node->left) >= size) {
+            node = node->left;
+        } else if (FREE(node)->size >= size) {
+            struct vm_free *f = FREE(node);
+            uint64_t start = f->start;
+            f->start += size;
+            f->size -= size;
+            if (f->size == 0) {
+                rb_erase_augmented(node, &free_ranges, &free_augment);
+                kmem_cache_free(free_cache, f);
+            } else {
+                free_propagate(node, 0);
+            }
+            return start;
+        } else if (subtree_max(node->right) >= size) {
+            node = node->right;
+        } else {
+            break;
+        }
+    }
+    return 0;
+}
+
+// Return [start, start + size) to the free ranges, merging it with its
+// neighbours. spare is a node to use if no merge happens, or 0.
+static void free_insert(uint64_t start, uint64_t size, struct vm_free *spare) {
+    struct rb_node **link = &free_ranges.node, *parent = 0;
+    struct vm_free *prev = 0, *next = 0;
+
+    while (*link) {
+        parent = *link;
+        if (start < FREE(parent)->start) {
+            next = FREE(parent);
+            link = &parent->left;
+        } else {
+            prev = FREE(parent);
+            link = &parent->right;
+        }
+    }
+
+    int merge_prev = prev && prev->start + prev->size == start;
+    int merge_next = next && start + size == next->start;
+
+    if (merge_prev && merge_next) {
+        // Erase before growing prev, rotations must see consistent sizes
+        rb_erase_augmented(&next->node, &free_ranges, &free_augment);
+        prev->size += size + next->size;
+        kmem_cache_free(free_cache, next);
+        free_propagate(&prev->node, 0);
+    } else if (merge_prev) {
+        prev->size += size;
+        free_propagate(&prev->node, 0);
+    } else if (merge_next) {
+        next->start = start;
+        next->size += size;
+        free_propagate(&next->node, 0);
+    } else if (spare != 0) {
+        spare->start = start;
+        spare->size = size;
+        spare->subtree_max = size;
+        rb_link_node(&spare->node, parent, link);
+        rb_insert_augmented(&spare->node, &free_ranges, &free_augment);
+        return;
+    } else {
+        printf("vm: lost free range %p-%p\n", start, start + size);
+    }
+
+    if (spare != 0)
+        kmem_cache_free(free_cache, spare);
+}
+
+// The reserved span of an area, guard page included
+static inline uint64_t span_start(struct vm_area *area) {
+    return area->flags & VM_STACK ? area->start - PGSIZE : area->start;
+}
+
+static inline uint64_t span_end(struct vm_area *area) {
+    return area->flags & VM_STACK ? area->end : area->end + PGSIZE;
+}
+
+static struct vm_area *find_area(uint64_t addr) {
+    struct rb_node *node = areas.node;
+
+    while (node) {
+        struct vm_area *a = AREA(node);
+        if (addr < span_start(a))
+            node = node->left;
+        else if (addr >= span_end(a))
+            node = node->right;
+        else
+            return a;
+    }
+    return 0;
+}
+
+static void insert_area(struct vm_area *area) {
+    struct rb_node **link = &areas.node, *parent = 0;
+
+    while (*link) {
+        parent = *link;
+        link = area->start < AREA(parent)->start ? &parent->left : &parent->right;
+    }
+    rb_link_node(&area->node, parent, link);
+    rb_insert_color(&area->node, &areas);
+}
+
+void vm_init(void) {
+    init_spinlock(&vm_lock, "vm");
+    init_spinlock(&uvm_lock, "uvm");
+    area_cache = kmem_cache_create("vm_area", sizeof(struct vm_area), 0, 0);
+    free_cache = kmem_cache_create("vm_free", sizeof(struct vm_free), 0, 0);
+
+    struct vm_free *all = kmem_cache_alloc(free_cache);
+    if (all == 0)
+        panic("vm_init");
+    free_insert(KVM_BASE, KVM_END - KVM_BASE, all);
+
+    // Allocate the area's top-level entries up front: address spaces
+    // copy the kernel PML4 when they are made and share what is below.
+    for (uint64_t va = KVM_BASE; va < KVM_END; va += 1UL << PX_SHIFT(3)) {
+        if (walk_level(kernel_pagetable, va, PDPT_LEVEL, 1) == 0)
+            panic("vm_init");
+    }
+}
+
+// Reserve size bytes of kernel address space plus a guard page
+struct vm_area *vm_reserve(uint64_t size, uint64_t prot, int flags) {
+    struct vm_area *area = kmem_cache_alloc(area_cache);
+    if (area == 0)
+        return 0;
+
+    size = PGROUNDUP(size);
+
+    acquire_spinlock(&vm_lock);
+    uint64_t base = free_take(size + PGSIZE);
+    if (base == 0) {
+        release_spinlock(&vm_lock);
+        kmem_cache_free(area_cache, area);
+        return 0;
+    }
+
+    area->start = flags & VM_STACK ? base + PGSIZE : base;
+    area->end = area->start + size;
+    area->prot = prot;
+    area->flags = flags;
+    area->color = KALLOC_ANY_COLOR;
+    insert_area(area);
+
+    // A stack fault may not allocate, so its page tables exist up front
+    int r = 0;
+    for (uint64_t va = area->start; va < area->end && (flags & VM_STACK); va += PGSIZE) {
+        if (walk(kernel_pagetable, va, 1) == 0)
+            r = -1;
+    }
+    release_spinlock(&vm_lock);
+
+    if (r < 0) {
+        vm_release(area);
+        return 0;
+    }
+    return area;
+}
+
+// Unmap the area, free the frames that were faulted in and give the
+// address range back
+void vm_release(struct vm_area *area) {
+    struct vm_free *spare = kmem_cache_alloc(free_cache);
+
+    acquire_spinlock(&vm_lock);
+    rb_erase(&area->node, &areas);
+    release_spinlock(&vm_lock);
+
+    struct mmu_gather tlb;
+    tlb_gather_init(&tlb, kernel_pagetable, 0);
+    unmap_range(&tlb, area->start, area->end - area->start, !(area->flags & VM_IO));
+    tlb_gather_finish(&tlb);
+
+    acquire_spinlock(&vm_lock);
+    free_insert(span_start(area), span_end(area) - span_start(area), spare);
+    release_spinlock(&vm_lock);
+
+    kmem_cache_free(area_cache, area);
+}
+
+static int is_guard(struct vm_area *area, uint64_t addr) {
+    return addr < area->start || addr >= area->end;
+}
+
+// Back the page at addr with a zeroed frame unless it already is.
+// Called with vm_lock held.
+static int back_page(struct vm_area *area, uint64_t addr) {
+    page_entry_raw *pte = walk(kernel_pagetable, addr, 1);
+    if (pte == 0)
+        return -1;
+    if (pte_present(*pte))
+        return 0;
+
+    // Colored areas take consecutive colors from the end they grow from
+    void *page;
+    if (area->color == KALLOC_ANY_COLOR)
+        page = kalloc_flags(KALLOC_ZERO);
+    else if (area->flags & VM_STACK)
+        page = kalloc_color(area->color + (area->end - PGSIZE - addr) / PGSIZE, KALLOC_ZERO);
+    else
+        page = kalloc_color(area->color + (addr - area->start) / PGSIZE, KALLOC_ZERO);
+    if (page == 0)
+        return -1;
+    *pte = make_pte(VIRT_TO_PHYS(page), area->prot | PTE_P | PTE_G);
+    return 0;
+}
+
+// Back [addr, addr + len) of area now, for memory that is needed before
+// faults can be taken or that must not fault.
+int vm_populate(struct vm_area *area, uint64_t addr, uint64_t len) {
+    int r = 0;
+
+    acquire_spinlock(&vm_lock);
+    for (uint64_t va = PGROUNDDOWN(addr); va < addr + len && r == 0; va += PGSIZE) {
+        if (is_guard(area, va))
+            r = -1;
+        else
+            r = back_page(area, va);
+    }
+    release_spinlock(&vm_lock);
+    return r;
+}
+
+static inline uint64_t thp_base(uint64_t va) {
+    return va & ~(LARGE_PGSIZE - 1);
+}
+
+// Whether the whole 2 MiB chunk at base is heap
+static inline int thp_fits(struct proc *proc, uint64_t base) {
+    return base >= UVM_BASE && base + LARGE_PGSIZE <= proc->brk;
+}
+
+// Map the 2 MiB page under pde with small pages from now on. The
+// block is broken up first so the pages can be freed one by one.
+// Called with uvm_lock held.
+static int thp_split(struct proc *proc, page_entry_raw *pde, uint64_t va) {
+    void *head = PHYS_TO_VIRT(pte_addr(*pde));
+    if (split_large(pde) < 0)
+        return -1;
+    if (va2page(head)->order == THP_ORDER)
+        kalloc_split(head, THP_ORDER);
+
+    // One invlpg anywhere in the page drops the whole large entry
+    tlb_flush_range(proc->pagetable, &proc->cpumask, thp_base(va), thp_base(va) + PGSIZE);
+    thp_stats.splits++;
+    return 0;
+}
+
+// The 2 MiB part of a heap fault. Returns 0 if resolved, -1 on
+// failure, 1 to go on with the small page under va.
+static int thp_fault(struct proc *proc, page_entry_raw *pde, uint64_t va, uint64_t error_code) {
+    if (!pte_present(*pde)) {
+        if (!thp_fits(proc, thp_base(va)))
+            return 1;
+        void *block = kalloc_order_flags(THP_ORDER, KALLOC_ZERO);
+        if (block == 0) {
+            thp_stats.fallbacks++;
+            return 1;
+        }
+        *pde = make_pte(VIRT_TO_PHYS(block), PTE_P | PTE_W | PTE_PS);
+        thp_stats.faults++;
+        return 0;
+    }
+    if (!pte_large(*pde))
+        return 1;
+
+    if (!(error_code & PF_W) || !(*pde & PTE_COW)) {
+        // Collapsed or made writable by another CPU since
+        tlb_flush_page(va);
+        return 0;
+    }
+
+    struct page *head = va2page(PHYS_TO_VIRT(pte_addr(*pde)));
+    if (head->order == THP_ORDER && head->refs == 1) {
+        *pde = (*pde | PTE_W) & ~PTE_COW;
+        tlb_flush_page(va);
+        return 0;
+    }
+
+    // Still shared: only the page written to is copied
+    return thp_split(proc, pde, va) < 0 ? -1 : 1;
+}
+
+// Faults in the private half of the loaded address space: heap pages
+// are backed on first touch or read back from swap, shared
+// copy-on-write pages are copied on the first write, or just made
+// writable again by their last user. Small pages faulted in go on
+// the LRU lists for reclaim. When memory runs out the fault is
+// retried if reclaim freed something, which is only tried when the
+// fault interrupted no spinlock holder. A fault taken with uvm_lock
+// or proc_lock held here fails instead of waiting on itself.
+static int uvm_fault(uint64_t addr, uint64_t error_code) {
+    uint64_t va = PGROUNDDOWN(addr);
+    void *old = 0;
+    int oom = 0;
+    int r = -1;
+
+    if (holding_spinlock_here(&uvm_lock) || holding_spinlock_here(&proc_lock))
+        return -1;
+
+    struct proc *proc = this_cpu_read(proc);
+    if (proc == 0)
+        return -1;
+
+    acquire_spinlock(&uvm_lock);
+    page_entry_raw *pde = 0, *pte = 0;
+    if (addr < proc->brk && (pde = walk_level(proc->pagetable, va, PD_LEVEL, 1)) != 0 &&
+        (r = thp_fault(proc, pde, va, error_code)) > 0) {
+        pte = walk(proc->pagetable, va, 1);
+        r = -1;
+    }
+
+    if (addr >= proc->brk) {
+        printf("page fault: %p is not mapped in pid %d\n", addr, (int) proc->pid);
+    } else if (pde == 0 || pte == 0) {
+        // Resolved at the 2 MiB level, or no memory for a page table
+        oom = r < 0;
+    } else if (pte_swapped(*pte)) {
+        void *page = kalloc_flags(KALLOC_NOINIT);
+        uint64_t slot = pte_swap_slot(*pte);
+        if (page == 0) {
+            oom = 1;
+        } else if (swap_read(slot, page) < 0) {
+            printf("page fault: cannot read %p back from swap\n", addr);
+            kfree(page);
+        } else {
+            *pte = make_pte(VIRT_TO_PHYS(page), PTE_P | PTE_W);
+            swap_free(slot);
+            lru_add(page, proc->pid, va);
+            r = 0;
+        }
+    } else if (!pte_present(*pte)) {
+        void *page = kalloc_flags(KALLOC_ZERO);
+        if (page != 0) {
+            *pte = make_pte(VIRT_TO_PHYS(page), PTE_P | PTE_W);
+            lru_add(page, proc->pid, va);
+            r = 0;
+        }
+        oom = page == 0;
+    } else if ((error_code & PF_W) && (*pte & PTE_COW)) {
+        void *cur = PHYS_TO_VIRT(pte_addr(*pte));
+        uint64_t flags = (pte_flags(*pte) | PTE_W) & ~PTE_COW;
+        if (va2page(cur)->refs == 1) {
+            // Only more rights: a stale entry elsewhere just faults again
+            *pte = make_pte(VIRT_TO_PHYS(cur), flags);
+            tlb_flush_page(va);
+            lru_add(cur, proc->pid, va);
+            r = 0;
+        } else {
+            void *page = kalloc_flags(KALLOC_NOINIT);
+            if (page != 0) {
+                memcpy(page, cur, PGSIZE);
+                *pte = make_pte(VIRT_TO_PHYS(page), flags);
+                lru_add(page, proc->pid, va);
+                old = cur;
+                r = 0;
+            }
+            oom = page == 0;
+        }
+    } else if (pte_present(*pte) && (!(error_code & PF_W) || (*pte & PTE_W))) {
+        // Resolved by another CPU since, our entry was stale
+        tlb_flush_page(va);
+        r = 0;
+    }
+    if (r == 0)
+        heap_faults++;
+    release_spinlock(&uvm_lock);
+
+    // Other threads may still read the old copy until they flush
+    if (old != 0) {
+        tlb_flush_range(proc->pagetable, &proc->cpumask, va, va + PGSIZE);
+        page_put(old);
+    }
+
+    // Reclaim takes proc_lock, uvm_lock, zswap_lock and ata_lock
+    if (oom && this_cpu_read(ncli) == 0 && reclaim_pages(RECLAIM_BATCH) > 0)
+        return 0;
+    if (oom)
+        printf("page fault: out of memory at %p in pid %d\n", addr, (int) proc->pid);
+    return r;
+}
+
+// Try to swap out a page taken off the LRU lists, on which the caller
+// holds a reference. Only pages mapped by their owner alone qualify.
+int uvm_reclaim_page(void *va) {
+    struct page *page = va2page(va);
+    int r = RECLAIM_KEEP;
+
+    acquire_spinlock(&proc_lock);
+    struct proc *proc = find_proc(page->owner);
+    if (proc == 0) {
+        release_spinlock(&proc_lock);
+        return RECLAIM_KEEP;
+    }
+
+    acquire_spinlock(&uvm_lock);
+    uint64_t index = page->index;
+    page_entry_raw *pte = walk(proc->pagetable, index, 0);
+    uint64_t slot;
+    if (pte == 0 || !pte_present(*pte) || pte_addr(*pte) != VIRT_TO_PHYS(va) || page->refs != 2) {
+        // Unmapped meanwhile, or shared after a fork
+    } else if (*pte & PTE_A) {
+        // Not flushed: a cached entry only delays the next A bit
+        *pte &= ~PTE_A;
+        r = RECLAIM_REFERENCED;
+    } else if ((slot = swap_alloc()) != 0) {
+        // Unmap first so no write can slip in behind the copy
+        page_entry_raw old = *pte;
+        *pte = make_swap_pte(slot);
+        tlb_flush_range(proc->pagetable, &proc->cpumask, index, index + PGSIZE);
+        if (swap_write(slot, va) < 0) {
+            *pte = old;
+            swap_free(slot);
+        } else {
+            page_put(va); // the mapping's reference
+            r = RECLAIM_SWAPPED;
+        }
+    }
+    release_spinlock(&uvm_lock);
+    release_spinlock(&proc_lock);
+
+    return r;
+}
+
+// Top up this CPU's reserve of zeroed frames for stack faults. Called
+// from schedule, which never interrupts a lock holder or the allocator.
+void vm_refill_stack_reserve(void) {
+    pushcli();
+    struct cpu *cpu = mycpu();
+    for (int i = 0; i < STACK_RESERVE_PAGES; i++) {
+        if (cpu->stack_reserve[i] != 0)
+            continue;
+        void *page = kalloc_flags(KALLOC_ZERO);
+        if (page == 0)
+            break;
+        cpu->stack_reserve[i] = page;
+    }
+    popcli();
+}
+
+// A fault that interrupted a spinlock holder, the allocator's per-CPU
+// lists among them, can only be the running thread's stack growing.
+// It may take no lock and enter no allocator, not even to print: the
+// frame comes from the CPU's reserve and the tables are there since
+// vm_reserve. The slots are taken and filled one store at a time, so
+// a fault in the middle of vm_refill_stack_reserve is fine too.
+static int stack_fault_atomic(uint64_t addr) {
+    struct thread *thread = mythread();
+    struct vm_area *area = thread ? thread->stack_area : 0;
+
+    if (area == 0 || addr < area->start - PGSIZE || addr >= area->end)
+        return -1;
+    if (addr < area->start)
+        panic("vm_fault: kernel stack overflow");
+
+    page_entry_raw *pte = walk(kernel_pagetable, PGROUNDDOWN(addr), 0);
+    if (pte == 0)
+        return -1;
+    if (pte_present(*pte))
+        return 0;
+
+    struct cpu *cpu = mycpu();
+    for (int i = 0; i < STACK_RESERVE_PAGES; i++) {
+        void *page = cpu->stack_reserve[i];
+        if (page != 0) {
+            cpu->stack_reserve[i] = 0;
+            *pte = make_pte(VIRT_TO_PHYS(page), area->prot | PTE_P | PTE_G);
+            return 0;
+        }
+    }
+    panic("vm_fault: stack reserve empty");
+    return -1;
+}
+
+// Resolve a page fault at addr. Returns 0 if the access can be retried.
+int vm_fault(uint64_t addr, uint64_t error_code) {
+    int r = -1;
+
+    if (addr >= UVM_BASE && addr < UVM_END)
+        return uvm_fault(addr, error_code);
+
+    if (addr < KVM_BASE || addr >= KVM_END || (error_code & PF_P))
+        return -1;
+
+    if (this_cpu_read(ncli) > 0)
+        return stack_fault_atomic(addr);
+
+    acquire_spinlock(&vm_lock);
+    struct vm_area *area = find_area(addr);
+    if (area == 0)
+        printf("page fault: %p is not reserved\n", addr);
+    else if (is_guard(area, addr))
+        printf("page fault: %s overrun into guard page %p\n", area->flags & VM_STACK ? "stack" : "buffer", addr);
+    else if ((r = back_page(area, PGROUNDDOWN(addr))) != 0)
+        printf("page fault: out of memory at %p\n", addr);
+    release_spinlock(&vm_lock);
+
+    return r;
+}
+
+int vm_is_guard(uint64_t addr) {
+    acquire_spinlock(&vm_lock);
+    struct vm_area *area = find_area(addr);
+    int r = area != 0 && is_guard(area, addr);
+    release_spinlock(&vm_lock);
+    return r;
+}
+
+// Share parent's private memory with child copy-on-write
+int uvm_copy(struct proc *parent, struct proc *child) {
+    acquire_spinlock(&uvm_lock);
+    int r = copy_pagetable_cow(parent->pagetable, child->pagetable);
+    child->brk = parent->brk;
+
+    release_spinlock(&uvm_lock);
+
+    // The parent's pages were made read-only behind the TLB's back
+    tlb_flush_range(parent->pagetable, &parent->cpumask, UVM_BASE, UVM_END);
+
+    return r;
+}
+
+// Move proc's heap end by n bytes and return the old end, or -1.
+// Growing only reserves the range, pages are backed when touched;
+// shrinking unmaps and frees them.
+uint64_t uvm_sbrk(struct proc *proc, int64_t n) {
+    acquire_spinlock(&uvm_lock);
+    uint64_t old_brk = proc->brk;
+    uint64_t new_brk = old_brk + n;
+    if (new_brk < UVM_BASE || new_brk > UVM_END) {
+        release_spinlock(&uvm_lock);
+        return (uint64_t) -1;
+    }
+
+    // A large page cut by the new end is split first
+    uint64_t cut = PGROUNDUP(new_brk);
+    if (cut < PGROUNDUP(old_brk) && thp_base(cut) != cut) {
+        page_entry_raw *pde = walk_level(proc->pagetable, cut, PD_LEVEL, 0);
+        if (pde != 0 && pte_present(*pde) && pte_large(*pde) && thp_split(proc, pde, cut) < 0) {
+            release_spinlock(&uvm_lock);
+            return (uint64_t) -1;
+        }
+    }
+
+    struct mmu_gather tlb;
+    tlb_gather_init(&tlb, proc->pagetable, &proc->cpumask);
+    if (cut < PGROUNDUP(old_brk))
+        unmap_range(&tlb, cut, PGROUNDUP(old_brk) - cut, 1);
+    proc->brk = new_brk;
+    tlb_gather_finish(&tlb);
+    release_spinlock(&uvm_lock);
+
+    return old_brk;
+}
+
+// Unmap and free all of proc's private memory
+void uvm_free(struct proc *proc) {
+    struct mmu_gather tlb;
+
+    acquire_spinlock(&uvm_lock);
+    tlb_gather_init(&tlb, proc->pagetable, &proc->cpumask);
+    unmap_range(&tlb, UVM_BASE, UVM_END - UVM_BASE, 1);
+    tlb_gather_finish(&tlb);
+    release_spinlock(&uvm_lock);
+}
+
+// Replace the page table under pde by one 2 MiB page if all 512
+// pages are mapped, writable and used by proc alone. Called with
+// uvm_lock held.
+static void thp_collapse(struct proc *proc, page_entry_raw *pde, uint64_t va) {
+    pagetable_t pt = pte_table(*pde);
+    for (int i = 0; i < ENTRIES_COUNT; i++) {
+        if (!pte_present(pt[i]) || !(pt[i] & PTE_W) || va2page(PHYS_TO_VIRT(pte_addr(pt[i])))->refs != 1)
+            return;
+    }
+
+    void *block = kalloc_order_flags(THP_ORDER, KALLOC_NOINIT);
+    if (block == 0)
+        return;
+
+    // Threads touching the chunk now fault and wait for uvm_lock
+    // while the pages are copied
+    uint64_t flags = PTE_P | PTE_W | PTE_PS | (pt[0] & PTE_U);
+    *pde = 0;
+    tlb_flush_range(proc->pagetable, &proc->cpumask, va, va + LARGE_PGSIZE);
+    for (int i = 0; i < ENTRIES_COUNT; i++)
+        memcpy((char *) block + i * PGSIZE, PHYS_TO_VIRT(pte_addr(pt[i])), PGSIZE);
+    *pde = make_pte(VIRT_TO_PHYS(block), flags);
+
+    for (int i = 0; i < ENTRIES_COUNT; i++)
+        page_put(PHYS_TO_VIRT(pte_addr(pt[i])));
+    kfree(pt);
+    thp_stats.promotions++;
+}
+
+// Background promotion, run from the idle loop: look at the next few
+// 2 MiB heap chunks, going round the processes one heap at a time.
+// Once a whole round went by without a heap fault there is nothing
+// new to collapse, and the scan waits for the next one.
+void thp_scan(void) {
+    if (thp_cursor.idle && thp_cursor.round == heap_faults)
+        return;
+
+    acquire_spinlock(&proc_lock);
+    if (proc_list == 0) {
+        release_spinlock(&proc_lock);
+        return;
+    }
+
+    // Resume where the last call stopped, or start over if that
+    // process is gone
+    struct proc_node *node = proc_list;
+    while (node->data->pid != thp_cursor.pid) {
+        node = node->next;
+        if (node == proc_list) {
+            thp_cursor.va = 0;
+            break;
+        }
+    }
+    struct proc *proc = node->data;
+    pid_t next = node->next->data->pid;
+    int wraps = node->next == proc_list;
+
+    // freeproc starts with uvm_free, so uvm_lock keeps proc alive
+    // without the proc list
+    acquire_spinlock(&uvm_lock);
+    release_spinlock(&proc_lock);
+    uint64_t va = thp_cursor.va;
+    if (va < thp_base(UVM_BASE + LARGE_PGSIZE - 1))
+        va = thp_base(UVM_BASE + LARGE_PGSIZE - 1);
+    for (int i = 0; i < THP_SCAN_CHUNKS && thp_fits(proc, va); i++, va += LARGE_PGSIZE) {
+        page_entry_raw *pde = walk_level(proc->pagetable, va, PD_LEVEL, 0);
+        if (pde != 0 && pte_present(*pde) && !pte_large(*pde))
+            thp_collapse(proc, pde, va);
+    }
+
+    if (thp_fits(proc, va)) {
+        thp_cursor.pid = proc->pid;
+        thp_cursor.va = va;
+    } else {
+        thp_cursor.pid = next;
+        thp_cursor.va = 0;
+        if (wraps) {
+            thp_cursor.idle = thp_cursor.round == heap_faults;
+            thp_cursor.round = heap_faults;
+        }
+    }
+    release_spinlock(&uvm_lock);
+}
+
+void thp_get_stats(struct thp_stats *stats) {
+    *stats = thp_stats;
+}
+
+void thp_print_stats(void) {
+    printf("thp: faults %d fallbacks %d splits %d promotions %d\n", (int) thp_stats.faults,
+           (int) thp_stats.fallbacks, (int) thp_stats.splits, (int) thp_stats.promotions);
+}
+
+// Virtually contiguous kernel memory built from single pages, for big
+// buffers that do not need to be physically contiguous
+void *vmalloc(uint64_t size) {
+    if (size == 0)
+        return 0;
+
+    struct vm_area *area = vm_reserve(size, PTE_W, VM_ALLOC);
+    if (area == 0)
+        return 0;
+    if (vm_populate(area, area->start, area->end - area->start) != 0) {
+        vm_release(area);
+        return 0;
+    }
+    return (void *) area->start;
+}
+
+void vfree(void *addr) {
+    if (addr == 0)
+        return;
+
+    acquire_spinlock(&vm_lock);
+    struct vm_area *area = find_area((uint64_t) addr);
+    release_spinlock(&vm_lock);
+
+    if (area == 0 || area->start != (uint64_t) addr || !(area->flags & VM_ALLOC)) {
+        printf("vfree: %p was not vmalloc'ed\n", addr);
+        panic("vfree");
+    }
+    vm_release(area);
+}
+
+// Map device memory [pa, pa + len) into kernel space with the given
+// memory type: PTE_UC for registers, PTE_WC for framebuffers. Apart
+// from the boot mapping of the first GiB the direct map covers only
+// RAM, and the one device range in that GiB, the legacy VGA hole, is
+// kept uncached by the MTRRs, so no cached alias of a device exists.
+void *ioremap(uint64_t pa, uint64_t len, uint64_t type) {
+    uint64_t off = pa & (PGSIZE - 1);
+    uint64_t prot = PTE_W | PTE_G | (type & PTE_CACHE_MASK);
+
+    struct vm_area *area = vm_reserve(off + len, prot, VM_IO);
+    if (area == 0)
+        return 0;
+    if (map_range(kernel_pagetable, area->start, pa - off, area->end - area->start, prot) < 0) {
+        vm_release(area);
+        return 0;
+    }
+    return (void *) (area->start + off);
+}
+
+void iounmap(void *addr) {
+    acquire_spinlock(&vm_lock);
+    struct vm_area *area = find_area((uint64_t) addr);
+    release_spinlock(&vm_lock);
+
+    if (area == 0 || !(area->flags & VM_IO)) {
+        printf("iounmap: %p was not ioremap'ed\n", addr);
+        panic("iounmap");
+    }
+    vm_release(area);
+}
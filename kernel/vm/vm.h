@@ -0,0 +1,76 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_VM_H
+#define UNTITLED_OS_VM_H
+
+#include <inttypes.h>
+#include "../lib/include/rbtree.h"
+
+// Page fault error code bits
+#define PF_P 0x1 // the page was present, protection violation
+#define PF_W 0x2 // write access
+#define PF_U 0x4 // user-mode access
+
+#define VM_STACK 0x1 // the guard page goes below the area instead of above
+#define VM_ALLOC 0x2 // made by vmalloc
+#define VM_IO 0x4    // made by ioremap, the frames are a device's
+
+// A reserved range of kernel virtual memory in [KVM_BASE, KVM_END).
+// Pages are backed with zeroed frames when first touched.
+struct vm_area {
+    struct rb_node node; // in the tree of areas, by start
+    uint64_t start;
+    uint64_t end;
+    uint64_t prot;      // PTE flags for pages faulted in
+    int flags;
+    int color;          // cache color of the first page backed, or KALLOC_ANY_COLOR
+};
+
+void vm_init(void);
+
+struct vm_area *vm_reserve(uint64_t size, uint64_t prot, int flags);
+
+void vm_release(struct vm_area *area);
+
+int vm_populate(struct vm_area *area, uint64_t addr, uint64_t len);
+
+int vm_fault(uint64_t addr, uint64_t error_code);
+
+void vm_refill_stack_reserve(void);
+
+int vm_is_guard(uint64_t addr);
+
+void *vmalloc(uint64_t size);
+
+void vfree(void *addr);
+
+void *ioremap(uint64_t pa, uint64_t len, uint64_t type);
+
+void iounmap(void *addr);
+
+// Transparent huge page events since boot
+struct thp_stats {
+    uint64_t faults;     // heap faults backed by a 2 MiB page
+    uint64_t fallbacks;  // eligible faults that found no free 2 MiB block
+    uint64_t splits;     // 2 MiB pages broken up for copy-on-write or a shrinking heap
+    uint64_t promotions; // chunks collapsed into a 2 MiB page by thp_scan
+};
+
+struct proc;
+
+int uvm_copy(struct proc *parent, struct proc *child);
+
+uint64_t uvm_sbrk(struct proc *proc, int64_t n);
+
+void uvm_free(struct proc *proc);
+
+void thp_scan(void);
+
+void thp_get_stats(struct thp_stats *stats);
+
+void thp_print_stats(void);
+
+#endif //UNTITLED_OS_VM_H
@@ -0,0 +1,200 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "zswap.h"
+#include "../memlayout.h"
+#include "../kalloc/kalloc.h"
+#include "../kalloc/kmalloc.h"
+#include "../kalloc/slab.h"
+#include "../sync/spinlock.h"
+#include "../lib/include/lz4.h"
+#include "../lib/include/memcpy.h"
+#include "../lib/include/panic.h"
+#include "../tty/tty.h"
+
+// Compressed cache in front of the swap disk. Pages written to a swap
+// slot are kept here LZ4-compressed when that saves at least a quarter
+// of the page, so swapping them back in costs a decompression instead
+// of a disk read. Pages filled with one repeated 64-bit word, zeroed
+// ones above all, are stored as just that word.
+//
+// Compressed objects live in a pool of slab caches, one per 128-byte
+// size class, which packs them densely into pages. The pool is
+// limited to a share of RAM; past that pages go straight to disk.
+
+struct zswap_entry {
+    uint32_t length; // compressed size, 0 for a same-filled page
+    uint64_t value;  // the repeated word of a same-filled page
+    void *data;      // compressed copy, from the pool
+};
+
+static struct spinlock zswap_lock;
+static struct zswap_entry **entries; // by swap slot
+static uint64_t nr_slots;
+static uint64_t pool_limit;          // bytes
+static struct kmem_cache *entry_cache;
+static struct kmem_cache *pool[ZPOOL_CLASSES];
+static char pool_names[ZPOOL_CLASSES][16];
+static struct zswap_stats stats;
+
+// Compressor scratch, used under zswap_lock
+static uint16_t lz4_table[LZ4_TABLE_SIZE];
+static uint8_t lz4_buf[ZSWAP_MAX_SIZE];
+
+static void class_name(char *buf, int size) {
+    char digits[8];
+    int n = 0;
+
+    memcpy(buf, "zpool-", 6);
+    buf += 6;
+    do {
+        digits[n++] = '0' + size % 10;
+        size /= 10;
+    } while (size > 0);
+    while (n > 0)
+        *buf++ = digits[--n];
+    *buf = 0;
+}
+
+void zswap_init(uint64_t nslots) {
+    init_spinlock(&zswap_lock, "zswap");
+
+    struct kmem_stats mem;
+    kmem_get_stats(&mem);
+    pool_limit = mem.total_pages * PGSIZE / 100 * ZSWAP_MAX_POOL_PERCENT;
+
+    entry_cache = kmem_cache_create("zswap_entry", sizeof(struct zswap_entry), 0, 0);
+    entries = kcalloc(nslots, sizeof(struct zswap_entry *));
+    if (entry_cache == 0 || entries == 0)
+        panic("zswap_init");
+    for (int i = 0; i < ZPOOL_CLASSES; i++) {
+        class_name(pool_names[i], (i + 1) * ZPOOL_CLASS_SIZE);
+        if ((pool[i] = kmem_cache_create(pool_names[i], (i + 1) * ZPOOL_CLASS_SIZE, 8, 0)) == 0)
+            panic("zswap_init");
+    }
+
+    nr_slots = nslots;
+    printf("zswap: pool up to %d KiB\n", (int) (pool_limit / 1024));
+}
+
+static inline int size_class(uint32_t length) {
+    return (length + ZPOOL_CLASS_SIZE - 1) / ZPOOL_CLASS_SIZE - 1;
+}
+
+static int same_filled(uint64_t *words, uint64_t *value) {
+    for (int i = 1; i < PGSIZE / 8; i++) {
+        if (words[i] != words[0])
+            return 0;
+    }
+    *value = words[0];
+    return 1;
+}
+
+static void free_entry(struct zswap_entry *entry) {
+    if (entry->length != 0) {
+        int class = size_class(entry->length);
+        kmem_cache_free(pool[class], entry->data);
+        stats.compressed_bytes -= entry->length;
+        stats.pool_bytes -= (class + 1) * ZPOOL_CLASS_SIZE;
+    } else {
+        stats.same_filled_pages--;
+    }
+    stats.stored_pages--;
+    kmem_cache_free(entry_cache, entry);
+}
+
+// Keep a compressed copy of page as the contents of slot. Returns 0,
+// or -1 if the page should go to disk instead.
+int zswap_store(uint64_t slot, void *page) {
+    if (slot >= nr_slots)
+        return -1;
+
+    struct zswap_entry *entry = kmem_cache_alloc(entry_cache);
+    if (entry == 0)
+        return -1;
+
+    acquire_spinlock(&zswap_lock);
+    if (entries[slot] != 0)
+        free_entry(entries[slot]); // a slot is rewritten only after it was freed
+
+    int r = 0;
+    entry->length = 0;
+    entry->data = 0;
+    if (!same_filled(page, &entry->value)) {
+        int length = lz4_compress(page, PGSIZE, lz4_buf, ZSWAP_MAX_SIZE, lz4_table);
+        int class = size_class(length);
+        if (length == 0) {
+            stats.rejected++;
+            r = -1;
+        } else if (stats.pool_bytes + (class + 1) * ZPOOL_CLASS_SIZE > pool_limit) {
+            stats.pool_full++;
+            r = -1;
+        } else if ((entry->data = kmem_cache_alloc(pool[class])) == 0) {
+            r = -1;
+        } else {
+            memcpy(entry->data, lz4_buf, length);
+            entry->length = length;
+            stats.compressed_bytes += length;
+            stats.pool_bytes += (class + 1) * ZPOOL_CLASS_SIZE;
+        }
+    } else {
+        stats.same_filled_pages++;
+    }
+
+    if (r == 0) {
+        entries[slot] = entry;
+        stats.stored_pages++;
+    }
+    release_spinlock(&zswap_lock);
+
+    if (r < 0)
+        kmem_cache_free(entry_cache, entry);
+    return r;
+}
+
+// Fill page with slot's contents if they are held here. Returns 0, or
+// -1 if they are on disk.
+int zswap_load(uint64_t slot, void *page) {
+    int r = -1;
+
+    acquire_spinlock(&zswap_lock);
+    struct zswap_entry *entry = slot < nr_slots ? entries[slot] : 0;
+    if (entry != 0 && entry->length == 0) {
+        uint64_t *words = page;
+        for (int i = 0; i < PGSIZE / 8; i++)
+            words[i] = entry->value;
+        r = 0;
+    } else if (entry != 0) {
+        if (lz4_decompress(entry->data, entry->length, page, PGSIZE) != PGSIZE)
+            panic("zswap_load: corrupt entry");
+        r = 0;
+    }
+    if (r == 0)
+        stats.loads++;
+    release_spinlock(&zswap_lock);
+
+    return r;
+}
+
+// The slot's last reference is gone
+void zswap_invalidate(uint64_t slot) {
+    acquire_spinlock(&zswap_lock);
+    if (slot < nr_slots && entries[slot] != 0) {
+        free_entry(entries[slot]);
+        entries[slot] = 0;
+    }
+    release_spinlock(&zswap_lock);
+}
+
+void zswap_get_stats(struct zswap_stats *out) {
+    *out = stats;
+}
+
+void zswap_print_stats(void) {
+    uint64_t pool_pages = (stats.pool_bytes + PGSIZE - 1) / PGSIZE;
+    printf("zswap: %d pages in %d pool pages (%d same-filled), %d rejected, %d over the limit, %d loads\n",
+           (int) stats.stored_pages, (int) pool_pages, (int) stats.same_filled_pages,
+           (int) stats.rejected, (int) stats.pool_full, (int) stats.loads);
+}
@@ -0,0 +1,38 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#ifndef UNTITLED_OS_ZSWAP_H
+#define UNTITLED_OS_ZSWAP_H
+
+#include <inttypes.h>
+
+#define ZPOOL_CLASS_SIZE 128        // compressed objects are rounded up to this
+#define ZSWAP_MAX_SIZE 3072         // pages that do not compress below this go to disk
+#define ZPOOL_CLASSES (ZSWAP_MAX_SIZE / ZPOOL_CLASS_SIZE)
+#define ZSWAP_MAX_POOL_PERCENT 20   // of RAM the compressed pool may take
+
+struct zswap_stats {
+    uint64_t stored_pages;      // pages held, same-filled ones included
+    uint64_t same_filled_pages; // held as a single repeated word
+    uint64_t compressed_bytes;  // sum of compressed sizes
+    uint64_t pool_bytes;        // pool memory those take
+    uint64_t rejected;          // did not compress well enough
+    uint64_t pool_full;         // refused because of the pool limit
+    uint64_t loads;
+};
+
+void zswap_init(uint64_t nslots);
+
+int zswap_store(uint64_t slot, void *page);
+
+int zswap_load(uint64_t slot, void *page);
+
+void zswap_invalidate(uint64_t slot);
+
+void zswap_get_stats(struct zswap_stats *stats);
+
+void zswap_print_stats(void);
+
+#endif //UNTITLED_OS_ZSWAP_H
@@ -3,40 +3,54 @@ extern kernel_main
 extern check_multiboot
 extern check_cpuid
 extern check_long_mode
-section .text
+
+; The kernel is linked at KERNBASE + its load address (see linker.ld),
+; so until paging is on, its symbols are reached at symbol - KERNBASE
+KERNBASE equ 0xFFFFFFFF80000000
+
+section .boot.text
 bits 32
 start:
-    mov esp, stack_top
+    mov esp, stack_top - KERNBASE
+    ; GRUB passes the physical address of the multiboot2 info in ebx,
+    ; keep it for kernel_main before cpuid clobbers the register
+    mov [multiboot_info - KERNBASE], ebx
     call check_multiboot
     call check_cpuid
     call check_long_mode
     jmp page_tables_setup
 
 page_tables_setup:
+    ; The first 1 GiB of physical memory is mapped three times through
+    ; the same p2 table: at 0 (identity, to turn paging on), at
+    ; 0xFFFF800000000000 (PML4 slot 256, the direct map) and at KERNBASE
+    ; (PML4 slot 511, PDPT slot 510, the kernel image).
     ; point first entry of p4 table to the first entry in p3 table
-    mov eax, p3_table
+    mov eax, p3_table - KERNBASE
     ; make first two bits 1
     ; present bit - page is currently in memory
     ; writable bit - page allowed to be written to
     or eax, 0b11
-    mov dword [p4_table + 0], eax
-    mov eax, p2_table
+    mov dword [p4_table - KERNBASE + 0], eax
+    mov dword [p4_table - KERNBASE + 256 * 8], eax
+    mov eax, p3_high_table - KERNBASE
     or eax, 0b11
-    mov dword [p3_table + 0], eax
-
-    mov eax, p1_table
+    mov dword [p4_table - KERNBASE + 511 * 8], eax
+    mov eax, p2_table - KERNBASE
     or eax, 0b11
-    mov dword [p2_table + 0], eax
+    mov dword [p3_table - KERNBASE + 0], eax
+    mov dword [p3_high_table - KERNBASE + 510 * 8], eax
 
+    ; map the first 1 GiB with 2 MiB pages, no p1 table needed
     mov ecx, 0 ; counter
-.map_p1_table:
-    mov eax, 0x1000  ; Physical address for this page
+.map_p2_table:
+    mov eax, 0x200000  ; Physical address for this 2 MiB page
     mul ecx
-    or eax, 0b11       ; Set Present (P), Read/Write (R/W), and User (U/S) flags
-    mov [p1_table + ecx * 8], eax
+    or eax, 0b10000011 ; Set Present (P), Read/Write (R/W) and Page Size (PS) flags
+    mov [p2_table - KERNBASE + ecx * 8], eax
     inc ecx
-    cmp ecx, 512        ; 512 entries in a page table
-    jl .map_p1_table
+    cmp ecx, 512        ; 512 entries in a page directory
+    jl .map_p2_table
 
 
 
@@ -44,7 +58,7 @@ page_tables_setup:
     ; move page table address to cr3
     ; using eax because we can move data to control register
     ; only from another register
-    mov eax, p4_table
+    mov eax, p4_table - KERNBASE
     mov cr3, eax
 
 .enable_pae:
@@ -66,7 +80,7 @@ page_tables_setup:
 
 
 .update_lgdr_register:
-    lgdt [gdt64.pointer]
+    lgdt [gdt64.pointer - KERNBASE]
 
 .update_selectors:
     mov ax, gdt64.data
@@ -86,13 +100,15 @@ p4_table:
     resb 4096
 p3_table:
     resb 4096
-p2_table:
+p3_high_table:
     resb 4096
-p1_table:
+p2_table:
     resb 4096
 stack_bottom:
     resb 4096*8
 stack_top:
+multiboot_info:
+    resd 1
 
 section .rodata
 gdt64:
@@ -105,15 +121,30 @@ gdt64:
     dq (1<<44) | (1<<47) | (1<<41)
 
 .pointer:
+    dw .pointer - gdt64 - 1
+    dq gdt64 - KERNBASE
+
+.pointer_high:
     dw .pointer - gdt64 - 1
     dq gdt64
 
     ; LONG MODE
-section .text
+section .boot.text
 bits 64
 long_mode_start:
+    ; still running at the load address, jump to the linked one
+    mov rax, higher_half_start
+    jmp rax
+
+section .text
+higher_half_start:
     mov rsp, stack_top
+    ; the GDT is reloaded through its higher-half address, the identity
+    ; map it was loaded through is dropped by kvminit
+    lgdt [gdt64.pointer_high]
 
+    ; first argument: multiboot2 info address (zero-extended)
+    mov edi, dword [multiboot_info]
     call kernel_main
 
     hlt
\ No newline at end of file
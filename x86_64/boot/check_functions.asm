@@ -1,6 +1,7 @@
 global check_multiboot
 global check_cpuid
 global check_long_mode
+section .boot.text
 bits 32
 check_multiboot:
     cmp eax, 0x36d76289 ; magic value (if multiboot comparable)